@@ -3,10 +3,203 @@
 
 #include "seal/memorymanager.h"
 
+using namespace std;
+using namespace seal::util;
+
 namespace seal
 {
+    void MemoryPoolProfile::save(ostream &stream) const
+    {
+        auto old_except_mask = stream.exceptions();
+        try
+        {
+            // Throw exceptions on ios_base::badbit and ios_base::failbit
+            stream.exceptions(ios_base::badbit | ios_base::failbit);
+
+            uint64_t size64 = size_histogram_.size();
+            stream.write(reinterpret_cast<const char*>(&size64), sizeof(uint64_t));
+            for (auto &entry : size_histogram_)
+            {
+                uint64_t byte_count64 = entry.first;
+                uint64_t item_count64 = entry.second;
+                stream.write(reinterpret_cast<const char*>(&byte_count64), sizeof(uint64_t));
+                stream.write(reinterpret_cast<const char*>(&item_count64), sizeof(uint64_t));
+            }
+        }
+        catch (const exception &)
+        {
+            stream.exceptions(old_except_mask);
+            throw;
+        }
+
+        stream.exceptions(old_except_mask);
+    }
+
+    void MemoryPoolProfile::load(istream &stream)
+    {
+        auto old_except_mask = stream.exceptions();
+        try
+        {
+            // Throw exceptions on ios_base::badbit and ios_base::failbit
+            stream.exceptions(ios_base::badbit | ios_base::failbit);
+
+            uint64_t size64 = 0;
+            stream.read(reinterpret_cast<char*>(&size64), sizeof(uint64_t));
+
+            // Read into a new histogram so that a failed load leaves this unchanged
+            vector<pair<size_t, size_t>> new_size_histogram;
+            for (uint64_t i = 0; i < size64; i++)
+            {
+                uint64_t byte_count64 = 0;
+                uint64_t item_count64 = 0;
+                stream.read(reinterpret_cast<char*>(&byte_count64), sizeof(uint64_t));
+                stream.read(reinterpret_cast<char*>(&item_count64), sizeof(uint64_t));
+                new_size_histogram.emplace_back(safe_cast<size_t>(byte_count64), 
+                    safe_cast<size_t>(item_count64));
+            }
+            size_histogram_ = move(new_size_histogram);
+        }
+        catch (const exception &)
+        {
+            stream.exceptions(old_except_mask);
+            throw;
+        }
+
+        stream.exceptions(old_except_mask);
+    }
+
+#ifndef _M_CEE
+    thread_local MMProfTenant::tenant_type MMProfTenant::thread_tenant_ = 0;
+
+    MMProfTenant::tenant_pool &MMProfTenant::get_tenant(tenant_type tenant)
+    {
+        {
+            ReaderLock lock(tenants_locker_.acquire_read());
+            auto it = tenants_.find(tenant);
+            if (it != tenants_.end())
+            {
+                return it->second;
+            }
+        }
+
+        WriterLock lock(tenants_locker_.acquire_write());
+        auto it = tenants_.find(tenant);
+        if (it != tenants_.end())
+        {
+            return it->second;
+        }
+        MemoryPoolOptions options = options_;
+        options.quota = make_shared<MemoryPoolQuota>(default_byte_quota_);
+        tenant_pool entry{ MemoryPoolHandle::New(clear_on_destruction_, 
+            size_classes_, options), options.quota };
+
+        // Entries are never erased, so references to them stay valid
+        return tenants_.emplace(tenant, move(entry)).first->second;
+    }
+
+    MemoryPoolHandle MMProfTenant::pool(tenant_type tenant)
+    {
+        return get_tenant(tenant).pool;
+    }
+
+    void MMProfTenant::set_quota(tenant_type tenant, size_t byte_quota)
+    {
+        get_tenant(tenant).quota->set_byte_limit(byte_quota);
+    }
+
+    MMProfTenant::Usage MMProfTenant::usage(tenant_type tenant) const
+    {
+        Usage usage;
+        ReaderLock lock(tenants_locker_.acquire_read());
+        auto it = tenants_.find(tenant);
+        if (it != tenants_.end())
+        {
+            auto &quota = *it->second.quota;
+            usage.byte_quota = quota.byte_limit();
+            usage.byte_count = quota.byte_count();
+            usage.peak_byte_count = quota.peak_byte_count();
+            usage.rejected_count = quota.rejected_count();
+            usage.stats = it->second.pool.stats();
+        }
+        return usage;
+    }
+
+    vector<MMProfTenant::tenant_type> MMProfTenant::tenants() const
+    {
+        vector<tenant_type> result;
+        ReaderLock lock(tenants_locker_.acquire_read());
+        result.reserve(tenants_.size());
+        for (auto &entry : tenants_)
+        {
+            result.push_back(entry.first);
+        }
+        return result;
+    }
+
+#endif
     std::unique_ptr<MMProf>
         MemoryManager::mm_prof_{ new MMProfGlobal };
+
+    MMProfGlobal MemoryManager::default_prof_;
+
+    atomic<MMProf*> MemoryManager::active_prof_{ &MemoryManager::default_prof_ };
+
+    atomic<size_t> MemoryManager::epoch_{ 0 };
+
+    MemoryManager::reader_slot MemoryManager::reader_slots_[reader_slot_count]{};
+#ifndef _M_CEE
+    thread_local size_t MemoryManager::reader_depth_ = 0;
+
+    thread_local MMProf *MemoryManager::thread_prof_ = nullptr;
+#endif
+
+    size_t MemoryManager::reader_slot_index() noexcept
+    {
+#ifndef _M_CEE
+        // Threads are assigned slots round-robin when they first read
+        static atomic<size_t> next_index{ 0 };
+        thread_local size_t index = 
+            next_index.fetch_add(1, memory_order_relaxed) % reader_slot_count;
+        return index;
+#else
+        return 0;
+#endif
+    }
+
+    void MemoryManager::publish(MMProf *mm_prof) noexcept
+    {
+        // All MMProfGlobal instances behave the same
+        if (typeid(*mm_prof) == typeid(MMProfGlobal))
+        {
+            mm_prof = &default_prof_;
+        }
+
+        // Readers use default_prof_ in place of a previous MMProfGlobal, so no 
+        // reader can still be using the previous profile
+        if (active_prof_.exchange(mm_prof) == &default_prof_)
+        {
+            return;
+        }
+
+        // Readers that loaded the previous profile counted themselves before, 
+        // in the epoch they read. Flip the epoch so that new readers do not 
+        // keep the old count from draining, and wait for it to drain. A reader 
+        // may have read the epoch before the flip but counted itself only 
+        // after an earlier grace period ended, so both epochs are drained.
+        for (int i = 0; i < 2; i++)
+        {
+            size_t old_epoch = epoch_.fetch_add(1) & 1;
+            for (auto &slot : reader_slots_)
+            {
+                while (slot.counts[old_epoch].load(memory_order_acquire) != 0)
+                {
+#ifndef _M_CEE
+                    this_thread::yield();
+#endif
+                }
+            }
+        }
+    }
 #ifndef _M_CEE
     std::mutex MemoryManager::switch_mutex_;
 #else
@@ -4,70 +4,175 @@
 #pragma once
 
 #include <memory>
+#include <atomic>
+#include <typeinfo>
 #include <stdexcept>
 #include <utility>
 #include <unordered_map>
+#include <vector>
+#include <limits>
+#include <iostream>
 #include "seal/util/mempool.h"
 #include "seal/util/globals.h"
 
 #ifndef _M_CEE
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 #endif
 
 namespace seal
 {
+    /**
+    Records how many allocations of each size a memory pool holds, typically at 
+    the end of a representative run. A profile can be saved to a file and used 
+    to prewarm a new memory pool at startup (see MemoryPoolHandle::prewarm), so 
+    that the first requests served do not pay for growing the pool.
+    */
+    class MemoryPoolProfile
+    {
+    public:
+        MemoryPoolProfile() = default;
+
+        /**
+        Creates a MemoryPoolProfile from pairs of allocation byte count and 
+        number of allocations.
+
+        @param[in] size_histogram The allocation counts for each size
+        */
+        MemoryPoolProfile(
+            std::vector<std::pair<std::size_t, std::size_t>> size_histogram) :
+            size_histogram_(std::move(size_histogram))
+        {
+        }
+
+        /**
+        Returns the pairs of allocation byte count and number of allocations.
+        */
+        inline auto &size_histogram() const noexcept
+        {
+            return size_histogram_;
+        }
+
+        /**
+        Saves the MemoryPoolProfile to an output stream. The output is in binary 
+        format and not human-readable. The output stream must have the "binary" 
+        flag set.
+
+        @param[in] stream The stream to save the MemoryPoolProfile to
+        @throws std::exception if the MemoryPoolProfile could not be written to stream
+        */
+        void save(std::ostream &stream) const;
+
+        /**
+        Loads a MemoryPoolProfile from an input stream overwriting the current 
+        MemoryPoolProfile.
+
+        @param[in] stream The stream to load the MemoryPoolProfile from
+        @throws std::exception if a valid MemoryPoolProfile could not be read from 
+        stream
+        */
+        void load(std::istream &stream);
+
+    private:
+        std::vector<std::pair<std::size_t, std::size_t>> size_histogram_;
+    };
+
     class MemoryPoolHandle
     {
     public:
         MemoryPoolHandle() = default;
 
         MemoryPoolHandle(std::shared_ptr<util::MemoryPool> pool) noexcept :
-            pool_(std::move(pool))
+            pool_(pool.get()), owner_(std::move(pool))
         {
         }
 
-        MemoryPoolHandle(const MemoryPoolHandle &copy) noexcept
+        MemoryPoolHandle(const MemoryPoolHandle &copy) noexcept :
+            pool_(copy.pool_), owner_(copy.owner_)
         {
-            operator =(copy);
         }
 
-        MemoryPoolHandle(MemoryPoolHandle &&source) noexcept
+        MemoryPoolHandle(MemoryPoolHandle &&source) noexcept :
+            pool_(source.pool_), owner_(std::move(source.owner_))
         {
-            operator =(std::move(source));
+            source.pool_ = nullptr;
         }
 
         inline MemoryPoolHandle &operator =(const MemoryPoolHandle &assign) noexcept
         {
             pool_ = assign.pool_;
+
+            // Handles to the static pools own nothing; copying them must not 
+            // touch a reference count
+            if (owner_ || assign.owner_)
+            {
+                owner_ = assign.owner_;
+            }
             return *this;
         }
 
         inline MemoryPoolHandle &operator =(MemoryPoolHandle &&assign) noexcept
         {
-            pool_ = std::move(assign.pool_);
+            auto pool = assign.pool_;
+            assign.pool_ = nullptr;
+            pool_ = pool;
+            if (owner_ || assign.owner_)
+            {
+                owner_ = std::move(assign.owner_);
+            }
             return *this;
         }
 
-        inline static MemoryPoolHandle Global()
+        inline static MemoryPoolHandle Global() noexcept
         {
-            return MemoryPoolHandle(
-                std::shared_ptr<util::MemoryPool>(std::shared_ptr<util::MemoryPool>(), 
-                util::global_variables::global_memory_pool.get()));
+            return MemoryPoolHandle(*util::global_variables::global_memory_pool);
         }
 #ifndef _M_CEE
-        inline static MemoryPoolHandle ThreadLocal()
+        inline static MemoryPoolHandle ThreadLocal() noexcept
         {
-            return MemoryPoolHandle(
-                std::shared_ptr<util::MemoryPool>(std::shared_ptr<util::MemoryPool>(), 
-                util::global_variables::tls_memory_pool.get()));
+            return MemoryPoolHandle(*util::global_variables::tls_memory_pool);
         }
 #endif
-        inline static MemoryPoolHandle New(bool clear_on_destruction = false) 
+        inline static MemoryPoolHandle New(bool clear_on_destruction = false,
+            util::SizeClassPolicy size_classes = util::SizeClassPolicy(),
+            util::MemoryPoolOptions options = util::MemoryPoolOptions()) 
+        {
+            return MemoryPoolHandle(std::make_shared<util::MemoryPoolMT>(
+                clear_on_destruction, std::move(size_classes), std::move(options)));
+        }
+        inline static MemoryPoolHandle NewArena(
+            std::size_t chunk_byte_count = util::MemoryPoolArena::default_chunk_byte_count,
+            bool clear_on_destruction = false,
+            util::SizeClassPolicy size_classes = util::SizeClassPolicy(),
+            util::MemoryPoolOptions options = util::MemoryPoolOptions())
+        {
+            return MemoryPoolHandle(std::make_shared<util::MemoryPoolArena>(
+                chunk_byte_count, clear_on_destruction, std::move(size_classes),
+                std::move(options)));
+        }
+        // Opens the named shared memory segment, creating it with byte_count 
+        // bytes if needed; see util::MemoryPoolShared
+        inline static MemoryPoolHandle NewShared(const std::string &name, 
+            std::size_t byte_count)
         {
             return MemoryPoolHandle(
-                std::make_shared<util::MemoryPoolMT>(clear_on_destruction));
+                std::make_shared<util::MemoryPoolShared>(name, byte_count));
+        }
+#ifndef _M_CEE
+        inline static MemoryPoolHandle NewThreadCached(
+            bool clear_on_destruction = false, 
+            std::size_t magazine_item_count = 
+                util::MemoryPoolTC::default_magazine_item_count,
+            util::SizeClassPolicy size_classes = util::SizeClassPolicy(),
+            util::MemoryPoolOptions options = util::MemoryPoolOptions())
+        {
+            return MemoryPoolHandle(std::make_shared<util::MemoryPoolTC>(
+                clear_on_destruction, magazine_item_count, std::move(size_classes),
+                std::move(options)));
         }
+#endif
 
         inline operator util::MemoryPool &() const
         {
@@ -75,7 +180,7 @@ namespace seal
             {
                 throw std::logic_error("pool not initialized");
             }
-            return *pool_.get();
+            return *pool_;
         }
 
         inline std::size_t pool_count() const
@@ -96,9 +201,113 @@ namespace seal
             return pool_->alloc_byte_count();
         }
 
+        inline std::size_t alloc_count() const
+        {
+            if (!pool_)
+            {
+                throw std::logic_error("pool not initialized");
+            }
+            return pool_->alloc_count();
+        }
+
+        inline std::size_t page_byte_count(util::page_type pages) const
+        {
+            if (!pool_)
+            {
+                throw std::logic_error("pool not initialized");
+            }
+            return pool_->page_byte_count(pages);
+        }
+
+        inline std::size_t alignment() const
+        {
+            if (!pool_)
+            {
+                throw std::logic_error("pool not initialized");
+            }
+            return pool_->alignment();
+        }
+
+        inline util::MemoryPoolStats stats() const
+        {
+            if (!pool_)
+            {
+                throw std::logic_error("pool not initialized");
+            }
+            return pool_->stats();
+        }
+
+        inline std::size_t requested_byte_count() const
+        {
+            if (!pool_)
+            {
+                throw std::logic_error("pool not initialized");
+            }
+            return pool_->requested_byte_count();
+        }
+
+        inline std::size_t rounded_byte_count() const
+        {
+            if (!pool_)
+            {
+                throw std::logic_error("pool not initialized");
+            }
+            return pool_->rounded_byte_count();
+        }
+
+        inline std::size_t trim()
+        {
+            if (!pool_)
+            {
+                throw std::logic_error("pool not initialized");
+            }
+            return pool_->trim();
+        }
+
+        inline std::size_t shrink_to(std::size_t byte_count)
+        {
+            if (!pool_)
+            {
+                throw std::logic_error("pool not initialized");
+            }
+            return pool_->shrink_to(byte_count);
+        }
+
+        inline void reserve(std::size_t byte_count, std::size_t item_count)
+        {
+            if (!pool_)
+            {
+                throw std::logic_error("pool not initialized");
+            }
+            pool_->reserve(byte_count, item_count);
+        }
+
+        inline MemoryPoolProfile profile() const
+        {
+            if (!pool_)
+            {
+                throw std::logic_error("pool not initialized");
+            }
+            return MemoryPoolProfile(pool_->size_histogram());
+        }
+
+        // Grows the pool so that the allocations recorded in profile fit without 
+        // obtaining more memory from the system allocator
+        inline void prewarm(const MemoryPoolProfile &profile)
+        {
+            if (!pool_)
+            {
+                throw std::logic_error("pool not initialized");
+            }
+            for (auto &entry : profile.size_histogram())
+            {
+                pool_->reserve(entry.first, entry.second);
+            }
+        }
+
         inline operator bool () const
         {
-            return pool_.operator bool();
+            return pool_ != nullptr;
         }
 
         inline bool operator ==(const MemoryPoolHandle &compare) noexcept
@@ -112,7 +321,150 @@ namespace seal
         }
 
     private:
-        std::shared_ptr<util::MemoryPool> pool_ = nullptr;
+        // Handle to a pool that outlives every handle, such as the global and 
+        // thread-local pools; nothing is reference counted
+        explicit MemoryPoolHandle(util::MemoryPool &pool) noexcept : pool_(&pool)
+        {
+        }
+
+        util::MemoryPool *pool_ = nullptr;
+
+        // Keeps pools created with New alive; empty for the static pools
+        std::shared_ptr<util::MemoryPool> owner_;
+    };
+
+#ifndef _M_CEE
+    /**
+    Releases memory held by a thread-safe memory pool in the background. A 
+    MemoryPoolTrimmer runs a thread that periodically trims the pool heads that 
+    have not been used for a given amount of time, so that a traffic spike does 
+    not permanently raise the memory usage of a long-running process. The 
+    thread is stopped when the MemoryPoolTrimmer is destroyed.
+    */
+    class MemoryPoolTrimmer
+    {
+    public:
+        /**
+        Creates a new MemoryPoolTrimmer and starts its thread.
+
+        @param[in] pool The MemoryPoolHandle pointing to a thread-safe memory pool
+        @param[in] idle_time How long a pool head must be unused to be trimmed
+        @param[in] interval How often the pool heads are inspected
+        @throws std::invalid_argument if pool is uninitialized or does not point 
+        to a thread-safe memory pool
+        */
+        MemoryPoolTrimmer(MemoryPoolHandle pool, 
+            std::chrono::steady_clock::duration idle_time,
+            std::chrono::steady_clock::duration interval = std::chrono::seconds(1)) :
+            pool_(std::move(pool))
+        {
+            if (!pool_)
+            {
+                throw std::invalid_argument("pool is uninitialized");
+            }
+            auto mt_pool = dynamic_cast<util::MemoryPoolMT*>(
+                &static_cast<util::MemoryPool&>(pool_));
+            if (!mt_pool)
+            {
+                throw std::invalid_argument("pool is not thread-safe");
+            }
+            thread_ = std::thread([this, mt_pool, idle_time, interval]() {
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (!cv_.wait_for(lock, interval, [this]() { return stop_; }))
+                {
+                    try
+                    {
+                        mt_pool->trim_idle(idle_time);
+                    }
+                    catch (...)
+                    {
+                        // Trimming is best effort
+                    }
+                }
+            });
+        }
+
+        /**
+        Stops the thread and destroys the MemoryPoolTrimmer.
+        */
+        ~MemoryPoolTrimmer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            thread_.join();
+        }
+
+    private:
+        MemoryPoolTrimmer(const MemoryPoolTrimmer &copy) = delete;
+
+        MemoryPoolTrimmer &operator =(const MemoryPoolTrimmer &assign) = delete;
+
+        MemoryPoolHandle pool_;
+
+        std::mutex mutex_;
+
+        std::condition_variable cv_;
+
+        bool stop_ = false;
+
+        std::thread thread_;
+    };
+#endif
+    /**
+    Resets an arena memory pool (see MemoryPoolHandle::NewArena) when going out 
+    of scope, so that all scratch memory allocated from it within the scope is 
+    reclaimed at once. If allocations from the arena are still outstanding at 
+    that point, for example because they belong to an enclosing scope, the 
+    arena is left as it is. Combine with MMProfFixed, set for the thread using 
+    the arena by an MMProfThreadGuard, to direct the temporary allocations of a 
+    request to the arena.
+    */
+    class MemoryPoolArenaScope
+    {
+    public:
+        /**
+        Creates a new MemoryPoolArenaScope.
+
+        @param[in] pool The MemoryPoolHandle pointing to an arena memory pool
+        @throws std::invalid_argument if pool is uninitialized or does not point 
+        to an arena memory pool
+        */
+        MemoryPoolArenaScope(MemoryPoolHandle pool) : pool_(std::move(pool))
+        {
+            if (!pool_)
+            {
+                throw std::invalid_argument("pool is uninitialized");
+            }
+            arena_ = dynamic_cast<util::MemoryPoolArena*>(
+                &static_cast<util::MemoryPool&>(pool_));
+            if (!arena_)
+            {
+                throw std::invalid_argument("pool is not an arena");
+            }
+        }
+
+        /**
+        Resets the arena unless allocations from it are outstanding.
+        */
+        ~MemoryPoolArenaScope() noexcept
+        {
+            if (!arena_->outstanding_count())
+            {
+                arena_->reset();
+            }
+        }
+
+    private:
+        MemoryPoolArenaScope(const MemoryPoolArenaScope &copy) = delete;
+
+        MemoryPoolArenaScope &operator =(const MemoryPoolArenaScope &assign) = delete;
+
+        MemoryPoolHandle pool_;
+
+        util::MemoryPoolArena *arena_ = nullptr;
     };
 
     using mm_prof_opt_t = std::uint64_t;
@@ -302,6 +654,212 @@ namespace seal
 
     private:
     };
+
+    /**
+    A memory manager profile that always returns a MemoryPoolHandle pointing to 
+    a thread-safe memory pool with per-thread caches, created when the profile 
+    is created. Each thread keeps a small number of free items of every size 
+    in a thread-local cache, so most allocations do not touch shared state. 
+    Unlike with MMProfThreadLocal, memory can be freely shared across threads 
+    and outlives the thread that allocated it.
+    */
+    class MMProfThreadCached : public MMProf
+    {
+    public:
+        /**
+        Creates a new MMProfThreadCached.
+
+        @param[in] magazine_item_count The maximum number of free items of each 
+        size cached by each thread
+        @throws std::invalid_argument if magazine_item_count is zero
+        */
+        MMProfThreadCached(std::size_t magazine_item_count = 
+            util::MemoryPoolTC::default_magazine_item_count) :
+            pool_(MemoryPoolHandle::NewThreadCached(false, magazine_item_count))
+        {
+        }
+
+        /**
+        Destroys the MMProfThreadCached.
+        */
+        virtual ~MMProfThreadCached() noexcept override
+        {
+        }
+
+        /**
+        Returns a MemoryPoolHandle pointing to the thread-caching memory pool. The 
+        mm_prof_opt_t input parameter has no effect.
+        */
+        inline virtual MemoryPoolHandle 
+            get_pool(mm_prof_opt_t) override
+        {
+            return pool_;
+        }
+
+    private:
+        MemoryPoolHandle pool_;
+    };
+
+    /**
+    A memory manager profile that gives every tenant of a multi-tenant process 
+    its own thread-safe memory pool, each with a limit on the memory it may 
+    obtain from the system (see util::MemoryPoolQuota). A tenant that reaches 
+    its quota gets std::bad_alloc instead of growing at the expense of the 
+    others. The tenant is taken from the calling thread, as set by an 
+    MMProfTenant::Scope; threads that have not set one use tenant 0. Pools 
+    are created on first use with the default quota.
+    */
+    class MMProfTenant : public MMProf
+    {
+    public:
+        using tenant_type = std::uint64_t;
+
+        /**
+        Sets the tenant of the calling thread for all MMProfTenant profiles, 
+        and restores the previous one when destroyed.
+        */
+        class Scope
+        {
+        public:
+            explicit Scope(tenant_type tenant) noexcept : 
+                prev_tenant_(thread_tenant_)
+            {
+                thread_tenant_ = tenant;
+            }
+
+            ~Scope() noexcept
+            {
+                thread_tenant_ = prev_tenant_;
+            }
+
+        private:
+            Scope(const Scope &copy) = delete;
+
+            Scope &operator =(const Scope &assign) = delete;
+
+            tenant_type prev_tenant_;
+        };
+
+        /**
+        Memory usage of a tenant.
+        */
+        struct Usage
+        {
+            std::size_t byte_quota = 0;
+
+            // Bytes currently obtained from the system
+            std::size_t byte_count = 0;
+
+            std::size_t peak_byte_count = 0;
+
+            // Number of allocations that failed because of the quota
+            std::size_t rejected_count = 0;
+
+            util::MemoryPoolStats stats;
+        };
+
+        /**
+        Creates a new MMProfTenant.
+
+        @param[in] default_byte_quota The quota of tenants not given one with 
+        set_quota
+        @param[in] clear_on_destruction Passed to the memory pool of each tenant
+        @param[in] size_classes Passed to the memory pool of each tenant
+        @param[in] options Passed to the memory pool of each tenant; the quota 
+        is replaced by the tenant's own
+        */
+        MMProfTenant(std::size_t default_byte_quota = 
+                std::numeric_limits<std::size_t>::max(),
+            bool clear_on_destruction = false,
+            util::SizeClassPolicy size_classes = util::SizeClassPolicy(),
+            util::MemoryPoolOptions options = util::MemoryPoolOptions()) :
+            default_byte_quota_(default_byte_quota),
+            clear_on_destruction_(clear_on_destruction),
+            size_classes_(std::move(size_classes)), options_(std::move(options))
+        {
+        }
+
+        /**
+        Destroys the MMProfTenant.
+        */
+        virtual ~MMProfTenant() noexcept override
+        {
+        }
+
+        /**
+        Returns a MemoryPoolHandle pointing to the memory pool of the tenant of 
+        the calling thread. The mm_prof_opt_t input parameter has no effect.
+        */
+        inline virtual MemoryPoolHandle 
+            get_pool(mm_prof_opt_t) override
+        {
+            return pool(thread_tenant_);
+        }
+
+        /**
+        Returns a MemoryPoolHandle pointing to the memory pool of a tenant, 
+        creating it if needed.
+
+        @param[in] tenant The tenant
+        */
+        MemoryPoolHandle pool(tenant_type tenant);
+
+        /**
+        Sets the quota of a tenant, creating its memory pool if needed. Lowering 
+        the quota does not release memory the pool already holds.
+
+        @param[in] tenant The tenant
+        @param[in] byte_quota The number of bytes the tenant's memory pool may 
+        obtain from the system
+        */
+        void set_quota(tenant_type tenant, std::size_t byte_quota);
+
+        /**
+        Returns the memory usage of a tenant; all zero for a tenant that has 
+        no memory pool yet.
+
+        @param[in] tenant The tenant
+        */
+        Usage usage(tenant_type tenant) const;
+
+        /**
+        Returns the tenants that have a memory pool.
+        */
+        std::vector<tenant_type> tenants() const;
+
+        /**
+        Returns the tenant of the calling thread.
+        */
+        inline static tenant_type thread_tenant() noexcept
+        {
+            return thread_tenant_;
+        }
+
+    private:
+        struct tenant_pool
+        {
+            MemoryPoolHandle pool;
+
+            std::shared_ptr<util::MemoryPoolQuota> quota;
+        };
+
+        // Returns the entry of a tenant, creating it if needed
+        tenant_pool &get_tenant(tenant_type tenant);
+
+        const std::size_t default_byte_quota_;
+
+        const bool clear_on_destruction_;
+
+        const util::SizeClassPolicy size_classes_;
+
+        const util::MemoryPoolOptions options_;
+
+        mutable util::ReaderWriterLocker tenants_locker_{ "MMProfTenant::tenants_locker_" };
+
+        std::unordered_map<tenant_type, tenant_pool> tenants_;
+
+        static thread_local tenant_type thread_tenant_;
+    };
 #endif
     /**
     The MemoryManager class can be used to create instances of MemoryPoolHandle 
@@ -313,19 +871,27 @@ namespace seal
     {
         friend class MMProfGuard;
 
+        friend class MMProfThreadGuard;
+
     public:
         MemoryManager() = delete;
 
         /**
         Sets the current profile to a given one and returns a unique_ptr pointing 
-        to the previously set profile.
+        to the previously set profile. Concurrent calls to GetPool are not 
+        blocked; instead this function waits until no thread is still using the 
+        previous profile, so that it can be safely destroyed. For the same reason 
+        it must not be called from within MMProf::get_pool, which would wait for 
+        the calling thread itself.
 
         @param[in] mm_prof Pointer to a new memory manager profile
         @throws std::invalid_argument if mm_prof is nullptr
+        @throws std::logic_error if called from within GetPool
         */
         static inline std::unique_ptr<MMProf>
-            SwitchProfile(MMProf* &&mm_prof) noexcept
+            SwitchProfile(MMProf* &&mm_prof)
         {
+            check_not_reading();
 #ifndef _M_CEE
             std::lock_guard<std::mutex> switching_lock(switch_mutex_);
 #endif
@@ -334,14 +900,20 @@ namespace seal
 
         /**
         Sets the current profile to a given one and returns a unique_ptr pointing 
-        to the previously set profile.
+        to the previously set profile. Concurrent calls to GetPool are not 
+        blocked; instead this function waits until no thread is still using the 
+        previous profile, so that it can be safely destroyed. For the same reason 
+        it must not be called from within MMProf::get_pool, which would wait for 
+        the calling thread itself.
 
         @param[in] mm_prof Pointer to a new memory manager profile
         @throws std::invalid_argument if mm_prof is nullptr
+        @throws std::logic_error if called from within GetPool
         */
         static inline std::unique_ptr<MMProf> SwitchProfile(
-            std::unique_ptr<MMProf> &&mm_prof) noexcept
+            std::unique_ptr<MMProf> &&mm_prof)
         {
+            check_not_reading();
 #ifndef _M_CEE
             std::lock_guard<std::mutex> switch_lock(switch_mutex_);
 #endif
@@ -360,7 +932,11 @@ namespace seal
 
         Other values for prof_opt are forwarded to the current profile and, depending 
         on the profile, may or may not have an effect. The value mm_prof_opt::DEFAULT
-        will always invoke a default behavior for the current profile.
+        will always invoke a default behavior for the current profile. The current 
+        profile is the one set for the calling thread by an MMProfThreadGuard, if 
+        any, and otherwise the global one, which is read without taking a lock, 
+        and while it is an MMProfGlobal (as it is unless switched) without 
+        touching any shared state.
 
         @param[in] prof_opt A mm_prof_opt_t parameter used to provide additional
         instructions to the memory manager profile for internal logic.
@@ -380,17 +956,16 @@ namespace seal
                     return MemoryPoolHandle::ThreadLocal();
 #endif
             default:
-#ifdef SEAL_DEBUG
+#ifndef _M_CEE
+                if (thread_prof_)
                 {
-                    auto pool = mm_prof_->get_pool(prof_opt);
-                    if (!pool)
-                    {
-                        throw std::logic_error("cannot return uninitialized pool");
-                    }
-                    return pool;
+                    return checked_pool(thread_prof_->get_pool(prof_opt));
                 }
 #endif
-                return mm_prof_->get_pool(prof_opt);
+                {
+                    ProfileReader reader;
+                    return checked_pool(reader.profile()->get_pool(prof_opt));
+                }
             }
         }
 
@@ -400,6 +975,98 @@ namespace seal
         }
 
     private:
+        static inline MemoryPoolHandle checked_pool(MemoryPoolHandle pool)
+        {
+#ifdef SEAL_DEBUG
+            if (!pool)
+            {
+                throw std::logic_error("cannot return uninitialized pool");
+            }
+#endif
+            return pool;
+        }
+
+        /*
+        The current profile is published read-copy-update style: readers count 
+        themselves in one of two epochs, spread over cache-line-sized slots, and 
+        a switch waits until the readers that may have seen the previous profile 
+        are done (a grace period). An MMProfGlobal is published as default_prof_, 
+        which is never destroyed, so readers that find it skip the counting.
+        */
+        struct alignas(64) reader_slot
+        {
+            std::atomic<std::size_t> counts[2];
+        };
+
+        static constexpr std::size_t reader_slot_count = 16;
+
+        // Returns the slot of the calling thread
+        static std::size_t reader_slot_index() noexcept;
+
+        class ProfileReader
+        {
+        public:
+            ProfileReader() noexcept : 
+                prof_(active_prof_.load(std::memory_order_acquire))
+            {
+                if (prof_ != &default_prof_)
+                {
+#ifndef _M_CEE
+                    reader_depth_++;
+#endif
+                    slot_ = &reader_slots_[reader_slot_index()];
+                    epoch_ = MemoryManager::epoch_.load() & 1;
+                    slot_->counts[epoch_].fetch_add(1);
+
+                    // Only a profile loaded after counting is covered by the 
+                    // grace period of the switch away from it
+                    prof_ = active_prof_.load();
+                }
+            }
+
+            ~ProfileReader() noexcept
+            {
+                if (slot_)
+                {
+                    slot_->counts[epoch_].fetch_sub(1, std::memory_order_release);
+#ifndef _M_CEE
+                    reader_depth_--;
+#endif
+                }
+            }
+
+            inline MMProf *profile() const noexcept
+            {
+                return prof_;
+            }
+
+        private:
+            ProfileReader(const ProfileReader &copy) = delete;
+
+            ProfileReader &operator =(const ProfileReader &assign) = delete;
+
+            MMProf *prof_;
+
+            reader_slot *slot_ = nullptr;
+
+            std::size_t epoch_ = 0;
+        };
+
+        // Makes mm_prof the profile seen by GetPool and waits for a grace period
+        static void publish(MMProf *mm_prof) noexcept;
+
+        // A switch waits for every GetPool that may use the previous profile, 
+        // so it must not be made by a thread that is inside GetPool
+        static inline void check_not_reading()
+        {
+#ifndef _M_CEE
+            if (reader_depth_)
+            {
+                throw std::logic_error("cannot switch profile from within GetPool");
+            }
+#endif
+        }
+
         static inline std::unique_ptr<MMProf>
             SwitchProfileThreadUnsafe(
                 MMProf* &&mm_prof)
@@ -410,6 +1077,7 @@ namespace seal
             }
             auto ret_mm_prof = std::move(mm_prof_);
             mm_prof_.reset(mm_prof);
+            publish(mm_prof_.get());
             return ret_mm_prof;
         }
 
@@ -422,11 +1090,29 @@ namespace seal
                 throw std::invalid_argument("mm_prof cannot be nullptr");
             }
             std::swap(mm_prof_, mm_prof);
+            publish(mm_prof_.get());
             return std::move(mm_prof);
         }
         
+        // Owns the current profile; only modified by switches
         static std::unique_ptr<MMProf> mm_prof_;
+
+        // Stands in for any MMProfGlobal set as the current profile
+        static MMProfGlobal default_prof_;
+
+        // The current profile as seen by GetPool
+        static std::atomic<MMProf*> active_prof_;
+
+        static std::atomic<std::size_t> epoch_;
+
+        static reader_slot reader_slots_[reader_slot_count];
 #ifndef _M_CEE
+        // Number of counted ProfileReaders alive on the calling thread
+        static thread_local std::size_t reader_depth_;
+
+        // Innermost profile set by an MMProfThreadGuard on the calling thread
+        static thread_local MMProf *thread_prof_;
+
         static std::mutex switch_mutex_;
 #endif
     };
@@ -437,7 +1123,8 @@ namespace seal
     not have to explicitly switch back afterwards and that other threads cannot 
     change the MMProf. It can also help with exception safety by guaranteeing that 
     the profile is switched back to the original if a function throws an exception 
-    after changing the profile for local use.
+    after changing the profile for local use. Like MemoryManager::SwitchProfile, 
+    an MMProfGuard must not be locked or unlocked from within MMProf::get_pool.
     */
     class MMProfGuard
     {
@@ -452,9 +1139,11 @@ namespace seal
         @param[in] mm_prof Pointer to a new memory manager profile
         @param[in] start_locked Bool indicating whether the lock should be
         immediately obtained (true by default)
+        @throws std::logic_error if start_locked is true and called from within 
+        MemoryManager::GetPool
         */
         MMProfGuard(std::unique_ptr<MMProf> &&mm_prof,
-            bool start_locked = true) noexcept :
+            bool start_locked = true) :
             mm_switch_lock_(MemoryManager::switch_mutex_,std::defer_lock)
         {
             if (start_locked)
@@ -477,9 +1166,11 @@ namespace seal
         @param[in] mm_prof Pointer to a new memory manager profile
         @param[in] start_locked Bool indicating whether the lock should be
         immediately obtained (true by default)
+        @throws std::logic_error if start_locked is true and called from within 
+        MemoryManager::GetPool
         */
         MMProfGuard(MMProf* &&mm_prof,
-            bool start_locked = true) noexcept :
+            bool start_locked = true) :
             mm_switch_lock_(MemoryManager::switch_mutex_, std::defer_lock)
         {
             if (start_locked)
@@ -499,6 +1190,7 @@ namespace seal
         on the first attempt, the function returns false; otherwise returns true.
 
         @throws std::runtime_error if the lock is already owned
+        @throws std::logic_error if called from within MemoryManager::GetPool
         */
         inline bool try_lock()
         {
@@ -506,6 +1198,7 @@ namespace seal
             {
                 throw std::runtime_error("lock is already owned");
             }
+            MemoryManager::check_not_reading();
             if (!mm_switch_lock_.try_lock())
             {
                 return false;
@@ -522,6 +1215,7 @@ namespace seal
         until the lock can be obtained.
 
         @throws std::runtime_error if the lock is already owned
+        @throws std::logic_error if called from within MemoryManager::GetPool
         */
         inline void lock()
         {
@@ -529,6 +1223,7 @@ namespace seal
             {
                 throw std::runtime_error("lock is already owned");
             }
+            MemoryManager::check_not_reading();
             mm_switch_lock_.lock();
             old_prof_ = MemoryManager::SwitchProfileThreadUnsafe(
                 std::move(old_prof_));
@@ -543,6 +1238,7 @@ namespace seal
 
         @param[in] mm_prof Pointer to a new memory manager profile
         @throws std::runtime_error if the lock is already owned
+        @throws std::logic_error if called from within MemoryManager::GetPool
         */
         inline bool try_lock(
             std::unique_ptr<MMProf> &&mm_prof)
@@ -551,6 +1247,7 @@ namespace seal
             {
                 throw std::runtime_error("lock is already owned");
             }
+            MemoryManager::check_not_reading();
             if (!mm_switch_lock_.try_lock())
             {
                 return false;
@@ -568,6 +1265,7 @@ namespace seal
 
         @param[in] mm_prof Pointer to a new memory manager profile
         @throws std::runtime_error if the lock is already owned
+        @throws std::logic_error if called from within MemoryManager::GetPool
         */
         inline void lock(
             std::unique_ptr<MMProf> &&mm_prof)
@@ -576,6 +1274,7 @@ namespace seal
             {
                 throw std::runtime_error("lock is already owned");
             }
+            MemoryManager::check_not_reading();
             mm_switch_lock_.lock();
             old_prof_ = MemoryManager::SwitchProfileThreadUnsafe(
                 std::move(mm_prof));
@@ -590,6 +1289,7 @@ namespace seal
 
         @param[in] mm_prof Pointer to a new memory manager profile
         @throws std::runtime_error if the lock is already owned
+        @throws std::logic_error if called from within MemoryManager::GetPool
         */
         inline bool try_lock(MMProf* &&mm_prof)
         {
@@ -597,6 +1297,7 @@ namespace seal
             {
                 throw std::runtime_error("lock is already owned");
             }
+            MemoryManager::check_not_reading();
             if (!mm_switch_lock_.try_lock())
             {
                 return false;
@@ -614,6 +1315,7 @@ namespace seal
 
         @param[in] mm_prof Pointer to a new memory manager profile
         @throws std::runtime_error if the lock is already owned
+        @throws std::logic_error if called from within MemoryManager::GetPool
         */
         inline void lock(MMProf* &&mm_prof)
         {
@@ -621,6 +1323,7 @@ namespace seal
             {
                 throw std::runtime_error("lock is already owned");
             }
+            MemoryManager::check_not_reading();
             mm_switch_lock_.lock();
             old_prof_ = MemoryManager::SwitchProfileThreadUnsafe(
                 std::move(mm_prof));
@@ -631,6 +1334,7 @@ namespace seal
         the current profile, and resets the profile to the one used before locking.
 
         @throw std::runtime_error if the lock is not owned
+        @throws std::logic_error if called from within MemoryManager::GetPool
         */
         inline void unlock()
         {
@@ -638,6 +1342,7 @@ namespace seal
             {
                 throw std::runtime_error("lock is not owned");
             }
+            MemoryManager::check_not_reading();
             old_prof_ = MemoryManager::SwitchProfileThreadUnsafe(
                 std::move(old_prof_));
             mm_switch_lock_.unlock();
@@ -672,5 +1377,65 @@ namespace seal
 
         std::unique_lock<std::mutex> mm_switch_lock_;
     };
+
+    /**
+    Class for a scoped switch of the memory manager profile of the calling thread 
+    only. While an MMProfThreadGuard exists, MemoryManager::GetPool called on 
+    the same thread uses its profile instead of the global one; other threads 
+    are not affected and no lock is taken. This lets, for example, each worker 
+    thread of a server direct its temporary allocations to its own arena 
+    (see MemoryPoolArenaScope). Guards on the same thread nest, and must be 
+    destroyed in the reverse order of their creation, as automatic variables are.
+    */
+    class MMProfThreadGuard
+    {
+    public:
+        /**
+        Creates a new MMProfThreadGuard and makes mm_prof the profile of the 
+        calling thread.
+
+        @param[in] mm_prof Pointer to a new memory manager profile
+        @throws std::invalid_argument if mm_prof is nullptr
+        */
+        MMProfThreadGuard(std::unique_ptr<MMProf> &&mm_prof) :
+            mm_prof_(std::move(mm_prof)), prev_prof_(MemoryManager::thread_prof_)
+        {
+            if (!mm_prof_)
+            {
+                throw std::invalid_argument("mm_prof cannot be nullptr");
+            }
+            MemoryManager::thread_prof_ = mm_prof_.get();
+        }
+
+        /**
+        Creates a new MMProfThreadGuard and makes mm_prof the profile of the 
+        calling thread.
+
+        @param[in] mm_prof Pointer to a new memory manager profile
+        @throws std::invalid_argument if mm_prof is nullptr
+        */
+        MMProfThreadGuard(MMProf* &&mm_prof) :
+            MMProfThreadGuard(std::unique_ptr<MMProf>(mm_prof))
+        {
+        }
+
+        /**
+        Destroys the MMProfThreadGuard and restores the profile the calling 
+        thread used before.
+        */
+        ~MMProfThreadGuard()
+        {
+            MemoryManager::thread_prof_ = prev_prof_;
+        }
+
+    private:
+        MMProfThreadGuard(const MMProfThreadGuard &copy) = delete;
+
+        MMProfThreadGuard &operator =(const MMProfThreadGuard &assign) = delete;
+
+        std::unique_ptr<MMProf> mm_prof_;
+
+        MMProf *prev_prof_;
+    };
 #endif
 }
@@ -3,10 +3,13 @@
 
 #define SEAL_VERSION "3.1.0"
 /* #undef SEAL_DEBUG */
+/* #undef SEAL_MEMPOOL_TRACE */
+/* #undef SEAL_LOCK_PROFILE */
 #define SEAL_USE_IF_CONSTEXPR
 #define SEAL_USE_MAYBE_UNUSED
 #define SEAL_USE_STD_BYTE
 #define SEAL_USE_SHARED_MUTEX
+/* #undef SEAL_USE_DISTRIBUTED_RW_LOCK */
 /* #undef SEAL_ENFORCE_HE_STD_SECURITY */
 #define SEAL_USE_INTRIN
 /* #undef SEAL_USE__UMUL128 */
@@ -136,6 +136,10 @@ namespace seal
 #define SEAL_MSB_INDEX_UINT64(result, value) get_msb_index_generic(result, value)
 #endif
 
+#ifndef SEAL_ASSUME_ALIGNED
+#define SEAL_ASSUME_ALIGNED(ptr, alignment) (ptr)
+#endif
+
 // Multiplication by a plaintext zero should not be allowed, and by default SEAL 
 // throws an exception in this case. For performance reasons one might want to 
 // undefine this if appropriate checks are guaranteed to be performed elsewhere.
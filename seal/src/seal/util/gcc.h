@@ -66,4 +66,7 @@
 
 #endif //SEAL_USE_INTRIN
 
+// Tell the optimizer that a pointer is aligned
+#define SEAL_ASSUME_ALIGNED(ptr, alignment) __builtin_assume_aligned(ptr, alignment)
+
 #endif
@@ -0,0 +1,248 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#include "seal/util/lockprofile.h"
+
+#ifdef SEAL_LOCK_PROFILE
+#include <algorithm>
+#include <functional>
+#ifndef _M_CEE
+#include <thread>
+#endif
+
+using namespace std;
+
+namespace seal
+{
+    namespace util
+    {
+        namespace
+        {
+            // Constant-initialized, so that locks in static objects can
+            // register during static initialization
+            atomic<bool> registry_locked{ false };
+
+            LockProfile *registry_first = nullptr;
+
+            inline void lock_flag(atomic<bool> &flag) noexcept
+            {
+                while (flag.exchange(true, memory_order_acquire));
+            }
+
+            inline void unlock_flag(atomic<bool> &flag) noexcept
+            {
+                flag.store(false, memory_order_release);
+            }
+
+            inline uint64_t to_ns(LockProfile::clock::duration duration) noexcept
+            {
+                auto ns = chrono::duration_cast<chrono::nanoseconds>(duration).count();
+                return ns > 0 ? static_cast<uint64_t>(ns) : 0;
+            }
+
+            inline uint64_t thread_tag() noexcept
+            {
+#ifndef _M_CEE
+                return static_cast<uint64_t>(hash<thread::id>()(this_thread::get_id()));
+#else
+                return 0;
+#endif
+            }
+
+            void save_json_string(ostream &stream, const char *value)
+            {
+                stream << '"';
+                for (; *value; value++)
+                {
+                    if (*value == '"' || *value == '\\')
+                    {
+                        stream << '\\';
+                    }
+                    stream << *value;
+                }
+                stream << '"';
+            }
+        }
+
+        LockProfile::LockProfile(const char *name, size_t tag) noexcept :
+            name_(name), tag_(tag)
+        {
+            lock_flag(registry_locked);
+            next_ = registry_first;
+            if (next_)
+            {
+                next_->prev_ = this;
+            }
+            registry_first = this;
+            unlock_flag(registry_locked);
+        }
+
+        LockProfile::~LockProfile() noexcept
+        {
+            lock_flag(registry_locked);
+            if (prev_)
+            {
+                prev_->next_ = next_;
+            }
+            else
+            {
+                registry_first = next_;
+            }
+            if (next_)
+            {
+                next_->prev_ = prev_;
+            }
+            unlock_flag(registry_locked);
+        }
+
+        void LockProfile::record_wait(clock::duration wait) noexcept
+        {
+            uint64_t wait_ns = to_ns(wait);
+            acquire_count_.fetch_add(1, memory_order_relaxed);
+            size_t bucket = 0;
+            for (uint64_t value = wait_ns; value && bucket < wait_bucket_count - 1; value >>= 1)
+            {
+                bucket++;
+            }
+            wait_buckets_[bucket].fetch_add(1, memory_order_relaxed);
+            if (!wait_ns)
+            {
+                return;
+            }
+            contended_count_.fetch_add(1, memory_order_relaxed);
+            wait_time_.fetch_add(wait_ns, memory_order_relaxed);
+            uint64_t max_wait_ns = max_wait_time_.load(memory_order_relaxed);
+            while (wait_ns > max_wait_ns && !max_wait_time_.compare_exchange_weak(
+                max_wait_ns, wait_ns, memory_order_relaxed));
+        }
+
+        void LockProfile::record_hold(clock::duration hold) noexcept
+        {
+            uint64_t hold_ns = to_ns(hold);
+            hold_time_.fetch_add(hold_ns, memory_order_relaxed);
+            if (hold_ns <= min_longest_hold_time_.load(memory_order_relaxed))
+            {
+                return;
+            }
+
+            lock_flag(longest_holds_locked_);
+            size_t index = longest_hold_count;
+            while (index && longest_hold_times_[index - 1] < hold_ns)
+            {
+                index--;
+            }
+            if (index < longest_hold_count)
+            {
+                for (size_t i = longest_hold_count - 1; i > index; i--)
+                {
+                    longest_hold_times_[i] = longest_hold_times_[i - 1];
+                    longest_hold_threads_[i] = longest_hold_threads_[i - 1];
+                }
+                longest_hold_times_[index] = hold_ns;
+                longest_hold_threads_[index] = thread_tag();
+                min_longest_hold_time_.store(
+                    longest_hold_times_[longest_hold_count - 1], memory_order_relaxed);
+            }
+            unlock_flag(longest_holds_locked_);
+        }
+
+        void LockProfile::reset() noexcept
+        {
+            acquire_count_.store(0, memory_order_relaxed);
+            contended_count_.store(0, memory_order_relaxed);
+            wait_time_.store(0, memory_order_relaxed);
+            max_wait_time_.store(0, memory_order_relaxed);
+            hold_time_.store(0, memory_order_relaxed);
+            for (auto &bucket : wait_buckets_)
+            {
+                bucket.store(0, memory_order_relaxed);
+            }
+            lock_flag(longest_holds_locked_);
+            fill_n(longest_hold_times_, longest_hold_count, uint64_t(0));
+            fill_n(longest_hold_threads_, longest_hold_count, uint64_t(0));
+            min_longest_hold_time_.store(0, memory_order_relaxed);
+            unlock_flag(longest_holds_locked_);
+        }
+
+        void LockProfile::save_json(ostream &stream) const
+        {
+            stream << "{\"name\":";
+            save_json_string(stream, name_);
+            stream << ",\"tag\":" << tag_
+                << ",\"address\":\"" << static_cast<const void*>(this) << '"'
+                << ",\"acquire_count\":" << acquire_count_.load(memory_order_relaxed)
+                << ",\"contended_count\":" << contended_count_.load(memory_order_relaxed)
+                << ",\"wait_ns\":" << wait_time_.load(memory_order_relaxed)
+                << ",\"max_wait_ns\":" << max_wait_time_.load(memory_order_relaxed)
+                << ",\"hold_ns\":" << hold_time_.load(memory_order_relaxed);
+
+            // Only non-empty buckets, keyed by their exclusive upper bound
+            stream << ",\"wait_histogram\":[";
+            bool first = true;
+            for (size_t i = 0; i < wait_bucket_count; i++)
+            {
+                uint64_t count = wait_buckets_[i].load(memory_order_relaxed);
+                if (!count)
+                {
+                    continue;
+                }
+                stream << (first ? "" : ",") << "{\"below_ns\":";
+                if (i < wait_bucket_count - 1)
+                {
+                    stream << (uint64_t(1) << i);
+                }
+                else
+                {
+                    stream << "null";
+                }
+                stream << ",\"count\":" << count << '}';
+                first = false;
+            }
+
+            stream << "],\"longest_holds\":[";
+            lock_flag(longest_holds_locked_);
+            for (size_t i = 0; i < longest_hold_count && longest_hold_times_[i]; i++)
+            {
+                stream << (i ? "," : "") << "{\"hold_ns\":" << longest_hold_times_[i]
+                    << ",\"thread\":" << longest_hold_threads_[i] << '}';
+            }
+            unlock_flag(longest_holds_locked_);
+            stream << "]}";
+        }
+
+        void dump_lock_profiles(ostream &stream)
+        {
+            stream << '[';
+            lock_flag(registry_locked);
+            try
+            {
+                for (LockProfile *profile = registry_first; profile; profile = profile->next_)
+                {
+                    if (profile != registry_first)
+                    {
+                        stream << ',';
+                    }
+                    profile->save_json(stream);
+                }
+            }
+            catch (...)
+            {
+                unlock_flag(registry_locked);
+                throw;
+            }
+            unlock_flag(registry_locked);
+            stream << ']';
+        }
+
+        void reset_lock_profiles() noexcept
+        {
+            lock_flag(registry_locked);
+            for (LockProfile *profile = registry_first; profile; profile = profile->next_)
+            {
+                profile->reset();
+            }
+            unlock_flag(registry_locked);
+        }
+    }
+}
+#endif
@@ -0,0 +1,136 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include "seal/util/defines.h"
+
+#ifdef SEAL_LOCK_PROFILE
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+namespace seal
+{
+    namespace util
+    {
+        /*
+        Contention statistics of a single lock instance, kept only when
+        SEAL_LOCK_PROFILE is defined: how often the lock was acquired, a
+        histogram of the time spent waiting for it, and the longest times it
+        was held together with the holding threads. Every LockProfile registers
+        itself on construction, so that dump_lock_profiles can write out all
+        live ones.
+        */
+        class LockProfile
+        {
+        public:
+            using clock = std::chrono::steady_clock;
+
+            // Bucket i counts waits of less than 2^i and at least 2^(i-1)
+            // nanoseconds; the last bucket also counts all longer waits
+            static constexpr std::size_t wait_bucket_count = 32;
+
+            // Number of longest hold times kept
+            static constexpr std::size_t longest_hold_count = 4;
+
+            // The name is not copied and must outlive the profile
+            LockProfile(const char *name, std::size_t tag = 0) noexcept;
+
+            ~LockProfile() noexcept;
+
+            // Starts timing a wait for the lock unless it was already started
+            inline static void begin_wait(clock::time_point &start) noexcept
+            {
+                if (start == clock::time_point())
+                {
+                    start = clock::now();
+                }
+            }
+
+            // Records an acquisition that waited since start, or did not wait
+            // if start was never set; returns the time of the acquisition
+            inline clock::time_point record_acquire(clock::time_point start) noexcept
+            {
+                auto now = clock::now();
+                record_wait(start == clock::time_point() ?
+                    clock::duration::zero() : now - start);
+                return now;
+            }
+
+            // Records an acquisition after waiting for the given time
+            void record_wait(clock::duration wait) noexcept;
+
+            // Records a release by the calling thread after holding the lock
+            // for the given time
+            void record_hold(clock::duration hold) noexcept;
+
+            void reset() noexcept;
+
+            // Writes the statistics as a JSON object
+            void save_json(std::ostream &stream) const;
+
+            inline const char *name() const noexcept
+            {
+                return name_;
+            }
+
+            // Distinguishes locks of the same name, e.g. the item size of a
+            // memory pool head
+            inline std::size_t tag() const noexcept
+            {
+                return tag_;
+            }
+
+        private:
+            friend void dump_lock_profiles(std::ostream &stream);
+
+            friend void reset_lock_profiles() noexcept;
+
+            LockProfile(const LockProfile &copy) = delete;
+
+            LockProfile &operator =(const LockProfile &assign) = delete;
+
+            const char *const name_;
+
+            const std::size_t tag_;
+
+            std::atomic<std::uint64_t> acquire_count_{ 0 };
+
+            // Acquisitions that had to wait at all
+            std::atomic<std::uint64_t> contended_count_{ 0 };
+
+            std::atomic<std::uint64_t> wait_time_{ 0 };
+
+            std::atomic<std::uint64_t> max_wait_time_{ 0 };
+
+            std::atomic<std::uint64_t> hold_time_{ 0 };
+
+            std::atomic<std::uint64_t> wait_buckets_[wait_bucket_count]{};
+
+            // Shortest of the longest hold times; shorter holds skip the lock
+            std::atomic<std::uint64_t> min_longest_hold_time_{ 0 };
+
+            mutable std::atomic<bool> longest_holds_locked_{ false };
+
+            // Longest hold times in nanoseconds and their threads, longest first
+            std::uint64_t longest_hold_times_[longest_hold_count]{};
+
+            std::uint64_t longest_hold_threads_[longest_hold_count]{};
+
+            // Registry of live profiles
+            LockProfile *prev_ = nullptr;
+
+            LockProfile *next_ = nullptr;
+        };
+
+        // Writes the statistics of all live lock profiles as a JSON array
+        void dump_lock_profiles(std::ostream &stream);
+
+        // Clears the statistics of all live lock profiles
+        void reset_lock_profiles() noexcept;
+    }
+}
+#endif
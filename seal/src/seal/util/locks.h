@@ -4,23 +4,130 @@
 #pragma once
 
 #include "seal/util/defines.h"
+#include "seal/util/lockprofile.h"
 
-#ifdef SEAL_USE_SHARED_MUTEX
+#if defined(SEAL_USE_SHARED_MUTEX) && !defined(SEAL_USE_DISTRIBUTED_RW_LOCK)
+#include <mutex>
 #include <shared_mutex>
 
 namespace seal
 {
     namespace util
     {
+#ifdef SEAL_LOCK_PROFILE
+        // Standard lock that records its wait and hold times in a LockProfile
+        template<typename Lock>
+        class ProfiledLock : public Lock
+        {
+        public:
+            ProfiledLock() noexcept = default;
+
+            ProfiledLock(typename Lock::mutex_type &mutex, LockProfile &profile) : 
+                Lock(mutex, std::try_to_lock), profile_(&profile)
+            {
+                LockProfile::clock::time_point start;
+                if (!Lock::owns_lock())
+                {
+                    LockProfile::begin_wait(start);
+                    Lock::lock();
+                }
+                held_since_ = profile.record_acquire(start);
+            }
+
+            ProfiledLock(typename Lock::mutex_type &mutex, LockProfile &profile, 
+                std::try_to_lock_t) : 
+                Lock(mutex, std::try_to_lock), profile_(&profile)
+            {
+                if (Lock::owns_lock())
+                {
+                    held_since_ = profile.record_acquire(LockProfile::clock::time_point());
+                }
+            }
+
+            ProfiledLock(ProfiledLock &&source) noexcept = default;
+
+            ~ProfiledLock() noexcept
+            {
+                record_hold();
+            }
+
+            inline ProfiledLock &operator =(ProfiledLock &&assign) noexcept
+            {
+                record_hold();
+                Lock::operator =(std::move(assign));
+                profile_ = assign.profile_;
+                held_since_ = assign.held_since_;
+                return *this;
+            }
+
+            inline void unlock()
+            {
+                record_hold();
+                Lock::unlock();
+            }
+
+        private:
+            inline void record_hold() noexcept
+            {
+                if (Lock::owns_lock())
+                {
+                    profile_->record_hold(LockProfile::clock::now() - held_since_);
+                }
+            }
+
+            LockProfile *profile_ = nullptr;
+
+            LockProfile::clock::time_point held_since_;
+        };
+
+        using ReaderLock = ProfiledLock<std::shared_lock<std::shared_mutex>>;
+
+        using WriterLock = ProfiledLock<std::unique_lock<std::shared_mutex>>;
+#else
         using ReaderLock = std::shared_lock<std::shared_mutex>;
 
         using WriterLock = std::unique_lock<std::shared_mutex>;
-
+#endif
         class ReaderWriterLocker
         {
         public:
-            ReaderWriterLocker() = default;
+            ReaderWriterLocker() : ReaderWriterLocker("ReaderWriterLocker")
+            {
+            }
+
+            // The name identifies the lock in lock profiles and must outlive it
+            explicit ReaderWriterLocker(const char *name) noexcept
+#ifdef SEAL_LOCK_PROFILE
+                : profile_(name)
+            {
+            }
+#else
+            {
+                (void)name;
+            }
+#endif
+
+#ifdef SEAL_LOCK_PROFILE
+            inline ReaderLock acquire_read()
+            {
+                return ReaderLock(rw_lock_mutex_, profile_);
+            }
+
+            inline WriterLock acquire_write()
+            {
+                return WriterLock(rw_lock_mutex_, profile_);
+            }
 
+            inline ReaderLock try_acquire_read() noexcept
+            {
+                return ReaderLock(rw_lock_mutex_, profile_, std::try_to_lock);
+            }
+
+            inline WriterLock try_acquire_write() noexcept
+            {
+                return WriterLock(rw_lock_mutex_, profile_, std::try_to_lock);
+            }
+#else
             inline ReaderLock acquire_read()
             {
                 return ReaderLock(rw_lock_mutex_);
@@ -40,18 +147,26 @@ namespace seal
             {
                 return WriterLock(rw_lock_mutex_, std::try_to_lock);
             }
-
+#endif
         private:
             ReaderWriterLocker(const ReaderWriterLocker &copy) = delete;
 
             ReaderWriterLocker &operator =(const ReaderWriterLocker &assign) = delete;
 
             std::shared_mutex rw_lock_mutex_;
+#ifdef SEAL_LOCK_PROFILE
+            LockProfile profile_;
+#endif
         };
     }
 }
 #else
 #include <atomic>
+#include <cstddef>
+#include <utility>
+#if defined(SEAL_USE_DISTRIBUTED_RW_LOCK) && defined(__linux__)
+#include <sched.h>
+#endif
 
 namespace seal
 {
@@ -68,22 +183,28 @@ namespace seal
         class ReaderLock
         {
         public:
-            ReaderLock() noexcept : locker_(nullptr)
+            ReaderLock() noexcept : locker_(nullptr), count_(nullptr)
             {
             }
 
-            ReaderLock(ReaderLock &&move) noexcept : locker_(move.locker_)
+            ReaderLock(ReaderLock &&move) noexcept : 
+                locker_(move.locker_), count_(move.count_)
             {
+#ifdef SEAL_LOCK_PROFILE
+                held_since_ = move.held_since_;
+#endif
                 move.locker_ = nullptr;
+                move.count_ = nullptr;
             }
 
-            ReaderLock(ReaderWriterLocker &locker) noexcept : locker_(nullptr)
+            ReaderLock(ReaderWriterLocker &locker) noexcept : 
+                locker_(nullptr), count_(nullptr)
             {
                 acquire(locker);
             }
 
             ReaderLock(ReaderWriterLocker &locker, try_to_lock_t) noexcept : 
-                locker_(nullptr)
+                locker_(nullptr), count_(nullptr)
             {
                 try_acquire(locker);
             }
@@ -103,6 +224,10 @@ namespace seal
             inline void swap_with(ReaderLock &lock) noexcept
             {
                 std::swap(locker_, lock.locker_);
+                std::swap(count_, lock.count_);
+#ifdef SEAL_LOCK_PROFILE
+                std::swap(held_since_, lock.held_since_);
+#endif
             }
 
             inline ReaderLock &operator =(ReaderLock &&lock) noexcept
@@ -117,7 +242,16 @@ namespace seal
 
             bool try_acquire(ReaderWriterLocker &locker) noexcept;
 
+            // Gives up the lock without recording it in the lock profile
+            void release() noexcept;
+
             ReaderWriterLocker *locker_;
+
+            // Reader count this lock incremented
+            std::atomic<int> *count_;
+#ifdef SEAL_LOCK_PROFILE
+            LockProfile::clock::time_point held_since_;
+#endif
         };
 
         class WriterLock
@@ -129,6 +263,9 @@ namespace seal
 
             WriterLock(WriterLock &&move) noexcept : locker_(move.locker_)
             {
+#ifdef SEAL_LOCK_PROFILE
+                held_since_ = move.held_since_;
+#endif
                 move.locker_ = nullptr;
             }
 
@@ -158,6 +295,9 @@ namespace seal
             inline void swap_with(WriterLock &lock) noexcept
             {
                 std::swap(locker_, lock.locker_);
+#ifdef SEAL_LOCK_PROFILE
+                std::swap(held_since_, lock.held_since_);
+#endif
             }
 
             inline WriterLock &operator =(WriterLock &&lock) noexcept
@@ -172,7 +312,13 @@ namespace seal
 
             bool try_acquire(ReaderWriterLocker &locker) noexcept;
 
+            // Gives up the lock without recording it in the lock profile
+            void release() noexcept;
+
             ReaderWriterLocker *locker_;
+#ifdef SEAL_LOCK_PROFILE
+            LockProfile::clock::time_point held_since_;
+#endif
         };
 
         class ReaderWriterLocker
@@ -182,10 +328,22 @@ namespace seal
             friend class WriterLock;
 
         public:
-            ReaderWriterLocker() noexcept : reader_locks_(0), writer_locked_(false)
+            ReaderWriterLocker() noexcept : ReaderWriterLocker("ReaderWriterLocker")
             {
             }
 
+            // The name identifies the lock in lock profiles and must outlive it
+            explicit ReaderWriterLocker(const char *name) noexcept
+#ifdef SEAL_LOCK_PROFILE
+                : profile_(name)
+            {
+            }
+#else
+            {
+                (void)name;
+            }
+#endif
+
             inline ReaderLock acquire_read() noexcept
             {
                 return ReaderLock(*this);
@@ -211,82 +369,216 @@ namespace seal
 
             ReaderWriterLocker &operator =(const ReaderWriterLocker &assign) = delete;
 
-            std::atomic<int> reader_locks_;
+#ifdef SEAL_USE_DISTRIBUTED_RW_LOCK
+            /*
+            Readers are spread over reader_slot_count counters on separate cache 
+            lines, so that readers on different cores do not contend; a writer 
+            waits for all of them to drain. This makes reads scale with the 
+            number of cores at the cost of reader_slot_count cache lines (1 KB) 
+            per lock and slower writes. On Linux a reader 
+            uses the counter of the CPU it runs on, so readers only share a 
+            counter on hosts with more than reader_slot_count CPUs; elsewhere 
+            threads are assigned counters round-robin, and more than 
+            reader_slot_count reading threads share counters.
+            */
+            static constexpr std::size_t reader_slot_count = 16;
+
+            struct alignas(64) reader_slot
+            {
+                std::atomic<int> count{ 0 };
+            };
+
+            static std::size_t reader_slot_index() noexcept
+            {
+#if defined(__linux__)
+                // A reader that migrates afterwards still releases the counter 
+                // it incremented, so the CPU only needs to be right most of the time
+                int cpu = sched_getcpu();
+                if (cpu >= 0)
+                {
+                    return static_cast<std::size_t>(cpu) % reader_slot_count;
+                }
+#endif
+#ifndef _M_CEE
+                // Threads are assigned slots round-robin when they first read
+                static std::atomic<std::size_t> next_index{ 0 };
+                thread_local std::size_t index = 
+                    next_index.fetch_add(1, std::memory_order_relaxed) % reader_slot_count;
+                return index;
+#else
+                return 0;
+#endif
+            }
+
+            inline std::atomic<int> &reader_count() noexcept
+            {
+                return reader_slots_[reader_slot_index()].count;
+            }
 
-            std::atomic<bool> writer_locked_;
+            inline bool has_readers() const noexcept
+            {
+                for (auto &slot : reader_slots_)
+                {
+                    if (slot.count.load())
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            reader_slot reader_slots_[reader_slot_count];
+
+            alignas(64) std::atomic<bool> writer_locked_{ false };
+#else
+            inline std::atomic<int> &reader_count() noexcept
+            {
+                return reader_locks_;
+            }
+
+            inline bool has_readers() const noexcept
+            {
+                return reader_locks_.load() != 0;
+            }
+
+            std::atomic<int> reader_locks_{ 0 };
+
+            std::atomic<bool> writer_locked_{ false };
+#endif
+#ifdef SEAL_LOCK_PROFILE
+            LockProfile profile_;
+#endif
         };
 
         inline void ReaderLock::unlock() noexcept
         {
+#ifdef SEAL_LOCK_PROFILE
+            if (locker_ != nullptr)
+            {
+                locker_->profile_.record_hold(LockProfile::clock::now() - held_since_);
+            }
+#endif
+            release();
+        }
+
+        inline void ReaderLock::release() noexcept
+        {
             if (locker_ == nullptr)
             {
                 return;
             }
-            locker_->reader_locks_.fetch_sub(1, std::memory_order_release);
+            count_->fetch_sub(1, std::memory_order_release);
             locker_ = nullptr;
+            count_ = nullptr;
         }
 
+        // Readers announce themselves before checking for a writer, and writers 
+        // the other way around; both orders must be sequentially consistent so 
+        // that at least one side sees the other
+
         inline void ReaderLock::acquire(ReaderWriterLocker &locker) noexcept
         {
             unlock();
+#ifdef SEAL_LOCK_PROFILE
+            LockProfile::clock::time_point start;
+#endif
+            std::atomic<int> &count = locker.reader_count();
             do
             {
-                locker.reader_locks_.fetch_add(1, std::memory_order_acquire);
+                count.fetch_add(1);
                 locker_ = &locker;
-                if (locker.writer_locked_.load(std::memory_order_acquire))
+                count_ = &count;
+                if (locker.writer_locked_.load())
                 {
-                    unlock();
+                    release();
+#ifdef SEAL_LOCK_PROFILE
+                    LockProfile::begin_wait(start);
+#endif
                     while (locker.writer_locked_.load(std::memory_order_acquire));
                 }
             } while (locker_ == nullptr);
+#ifdef SEAL_LOCK_PROFILE
+            held_since_ = locker.profile_.record_acquire(start);
+#endif
         }
 
         inline bool ReaderLock::try_acquire(ReaderWriterLocker &locker) noexcept
         {
             unlock();
-            locker.reader_locks_.fetch_add(1, std::memory_order_acquire);
+            std::atomic<int> &count = locker.reader_count();
+            count.fetch_add(1);
             locker_ = &locker;
-            if (locker.writer_locked_.load(std::memory_order_acquire))
+            count_ = &count;
+            if (locker.writer_locked_.load())
             {
-                unlock();
+                release();
                 return false;
             }
+#ifdef SEAL_LOCK_PROFILE
+            held_since_ = locker.profile_.record_acquire(LockProfile::clock::time_point());
+#endif
             return true;
         }
 
         inline void WriterLock::acquire(ReaderWriterLocker &locker) noexcept
         {
             unlock();
+#ifdef SEAL_LOCK_PROFILE
+            LockProfile::clock::time_point start;
+#endif
             bool expected = false;
-            while (!locker.writer_locked_.compare_exchange_strong(
-                expected, true, std::memory_order_acquire))
+            while (!locker.writer_locked_.compare_exchange_strong(expected, true))
             {
+#ifdef SEAL_LOCK_PROFILE
+                LockProfile::begin_wait(start);
+#endif
                 expected = false;
             }
             locker_ = &locker;
-            while (locker.reader_locks_.load(std::memory_order_acquire) != 0);
+            while (locker.has_readers())
+            {
+#ifdef SEAL_LOCK_PROFILE
+                LockProfile::begin_wait(start);
+#endif
+            }
+#ifdef SEAL_LOCK_PROFILE
+            held_since_ = locker.profile_.record_acquire(start);
+#endif
         }
 
         inline bool WriterLock::try_acquire(ReaderWriterLocker &locker) noexcept
         {
             unlock();
             bool expected = false;
-            if (!locker.writer_locked_.compare_exchange_strong(
-                expected, true, std::memory_order_acquire))
+            if (!locker.writer_locked_.compare_exchange_strong(expected, true))
             {
                 return false;
             }
             locker_ = &locker;
-            if (locker.reader_locks_.load(std::memory_order_acquire) != 0)
+            if (locker.has_readers())
             {
-                unlock();
+                release();
                 return false;
             }
+#ifdef SEAL_LOCK_PROFILE
+            held_since_ = locker.profile_.record_acquire(LockProfile::clock::time_point());
+#endif
             return true;
         }
 
         inline void WriterLock::unlock() noexcept
         {
+#ifdef SEAL_LOCK_PROFILE
+            if (locker_ != nullptr)
+            {
+                locker_->profile_.record_hold(LockProfile::clock::now() - held_since_);
+            }
+#endif
+            release();
+        }
+
+        inline void WriterLock::release() noexcept
+        {
             if (locker_ == nullptr)
             {
                 return;
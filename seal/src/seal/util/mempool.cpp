@@ -6,444 +6,2501 @@
 #include <numeric>
 #include <stdexcept>
 #include <algorithm>
+#include <unordered_map>
+#include <array>
 #include "seal/util/mempool.h"
 #include "seal/util/common.h"
 #include "seal/util/uintarith.h"
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#ifndef _M_CEE
+#include <thread>
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+#define SEAL_MEMPOOL_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define SEAL_MEMPOOL_ASAN
+#endif
+#endif
+
+#ifdef SEAL_MEMPOOL_ASAN
+#include <sanitizer/asan_interface.h>
+#else
+#define ASAN_POISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
+#define ASAN_UNPOISON_MEMORY_REGION(addr, size) ((void)(addr), (void)(size))
+#endif
+
 using namespace std;
 
 namespace seal
 {
     namespace util
     {
-        MemoryPoolHeadMT::MemoryPoolHeadMT(size_t item_byte_count,
-            bool clear_on_destruction) : 
-            clear_on_destruction_(clear_on_destruction),
-            locked_(false), item_byte_count_(item_byte_count), 
-            item_count_(MemoryPool::first_alloc_count), 
-            first_item_(nullptr)
+        namespace
         {
-            if ((item_byte_count_ == 0) || 
-                (item_byte_count_ > MemoryPool::max_batch_alloc_byte_count) ||
-                (mul_safe(item_byte_count_, MemoryPool::first_alloc_count) > 
-                    MemoryPool::max_batch_alloc_byte_count))
-            {
-                throw invalid_argument("invalid allocation size");
-            }
-
-            // Initial allocation
-            allocation new_alloc;
-            try
-            {
-                new_alloc.data_ptr = new SEAL_BYTE[
-                    mul_safe(MemoryPool::first_alloc_count, item_byte_count_)];
-            }
-            catch (const bad_alloc &)
+#if defined(__linux__)
+            // Maps byte_count bytes of anonymous memory aligned to alignment
+            void *map_aligned(size_t byte_count, size_t alignment, int flags) noexcept
             {
-                // Allocation failed; rethrow
-                throw;
-            }
-
-            new_alloc.size = MemoryPool::first_alloc_count;
-            new_alloc.free = MemoryPool::first_alloc_count;
-            new_alloc.head_ptr = new_alloc.data_ptr;
-            allocs_.clear();
-            allocs_.push_back(new_alloc);
-        }
+                size_t map_byte_count = byte_count + alignment;
+                if (map_byte_count < byte_count)
+                {
+                    return MAP_FAILED;
+                }
+                auto ptr = static_cast<SEAL_BYTE*>(mmap(nullptr, map_byte_count, 
+                    PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0));
+                if (static_cast<void*>(ptr) == MAP_FAILED)
+                {
+                    return MAP_FAILED;
+                }
 
-        MemoryPoolHeadMT::~MemoryPoolHeadMT() noexcept
-        {
-            bool expected = false;
-            while (!locked_.compare_exchange_strong(
-                expected, true, memory_order_acquire))
-            {
-                expected = false;
+                // Unmap the unaligned head and the tail
+                auto aligned_ptr = reinterpret_cast<SEAL_BYTE*>(
+                    (reinterpret_cast<uintptr_t>(ptr) + alignment - 1) & ~(alignment - 1));
+                size_t head_byte_count = static_cast<size_t>(aligned_ptr - ptr);
+                if (head_byte_count)
+                {
+                    munmap(ptr, head_byte_count);
+                }
+                munmap(aligned_ptr + byte_count, alignment - head_byte_count);
+                return aligned_ptr;
             }
 
-            // Delete the items (but not the memory)
-            MemoryPoolItem *curr_item = first_item_;
-            while (curr_item)
+            // Length of the mapping that map_data creates for byte_count bytes
+            size_t mapped_byte_count(size_t byte_count, page_type pages) noexcept
             {
-                MemoryPoolItem *next_item = curr_item->next();
-                delete curr_item;
-                curr_item = next_item;
+                size_t alignment = (pages != page_type::standard && 
+                    byte_count >= huge_page_byte_count) ? 
+                    huge_page_byte_count : static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                return (byte_count + alignment - 1) & ~(alignment - 1);
             }
-            first_item_ = nullptr;
 
-            if (clear_on_destruction_)
+            // Maps byte_count bytes backed by the requested kind of pages, 
+            // preferably on numa_node, and sets obtained to the pages obtained
+            SEAL_BYTE *map_data(size_t byte_count, page_type pages, int numa_node, 
+                page_type &obtained)
             {
-                // Delete the memory
-                for (auto &alloc : allocs_)
+                size_t map_byte_count = mapped_byte_count(byte_count, pages);
+                if (map_byte_count < byte_count)
+                {
+                    throw bad_alloc();
+                }
+                void *ptr = MAP_FAILED;
+                if (pages == page_type::huge && byte_count >= huge_page_byte_count)
+                {
+                    ptr = mmap(nullptr, map_byte_count, PROT_READ | PROT_WRITE, 
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                    obtained = page_type::huge;
+                }
+                if (ptr == MAP_FAILED)
                 {
-                    // Do we need to clear the memory?
-                    if (clear_on_destruction_)
+                    // Align large mappings to huge pages so that they can be 
+                    // backed by transparent huge pages in full
+                    bool want_huge = pages != page_type::standard && 
+                        byte_count >= huge_page_byte_count;
+                    size_t alignment = want_huge ? huge_page_byte_count : 
+                        static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                    ptr = map_aligned(map_byte_count, alignment, 0);
+                    if (ptr == MAP_FAILED)
                     {
-                        std::size_t curr_alloc_byte_count = mul_safe(item_byte_count_, alloc.size);
-                        volatile SEAL_BYTE *data_ptr = reinterpret_cast<SEAL_BYTE*>(alloc.data_ptr);
-                        while (curr_alloc_byte_count--)
-                        {
-                            *data_ptr++ = static_cast<SEAL_BYTE>(0);
-                        }
+                        throw bad_alloc();
                     }
-
-                    // Delete this allocation
-                    delete[] alloc.data_ptr;
+                    obtained = (want_huge && 
+                        !madvise(ptr, map_byte_count, MADV_HUGEPAGE)) ?
+                        page_type::transparent_huge : page_type::standard;
                 }
-            }
-            else
-            {
-                // Delete the memory
-                for (auto &alloc : allocs_)
+                if (numa_node >= 0)
                 {
-                    // Delete this allocation
-                    delete[] alloc.data_ptr;
+                    // Prefer the given node; this is best effort, so errors 
+                    // (e.g. no NUMA support) are ignored
+                    constexpr int mpol_preferred = 1;
+                    constexpr size_t bits_per_ulong = sizeof(unsigned long) * 8;
+                    unsigned long node_mask[1024 / bits_per_ulong] = {};
+                    size_t node = static_cast<size_t>(numa_node);
+                    node_mask[node / bits_per_ulong] = 1UL << (node % bits_per_ulong);
+                    syscall(SYS_mbind, ptr, map_byte_count, mpol_preferred, 
+                        node_mask, static_cast<unsigned long>(1024 + 1), 0U);
                 }
+                return static_cast<SEAL_BYTE*>(ptr);
             }
 
-            allocs_.clear();
-        }
-
-        MemoryPoolItem *MemoryPoolHeadMT::get()
-        {
-            bool expected = false;
-            while (!locked_.compare_exchange_strong(
-                expected, true, memory_order_acquire))
+            // Maps memory for alloc as requested by options and records what was obtained
+            template<typename Slab>
+            void map_allocation_data(Slab &alloc, 
+                size_t byte_count, const MemoryPoolOptions &options)
             {
-                expected = false;
+                if (options.debug.enabled && options.debug.guard_pages)
+                {
+                    // Place the data right before the guard page; byte_count is a 
+                    // multiple of the alignment, which divides the page size
+                    size_t page_byte_count = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                    size_t data_byte_count = mul_safe(
+                        divide_round_up(byte_count, page_byte_count), page_byte_count);
+                    size_t map_byte_count = add_safe(data_byte_count, page_byte_count);
+                    void *ptr = map_aligned(map_byte_count, page_byte_count, 0);
+                    if (ptr == MAP_FAILED)
+                    {
+                        throw bad_alloc();
+                    }
+                    mprotect(static_cast<SEAL_BYTE*>(ptr) + data_byte_count, 
+                        page_byte_count, PROT_NONE);
+                    alloc.data_ptr = static_cast<SEAL_BYTE*>(ptr) + 
+                        (data_byte_count - byte_count);
+                    alloc.mapped_byte_count = map_byte_count;
+                    alloc.pages = page_type::standard;
+                    return;
+                }
+                alloc.data_ptr = map_data(byte_count, options.pages, 
+                    options.numa_node, alloc.pages);
+                alloc.mapped_byte_count = mapped_byte_count(byte_count, options.pages);
             }
-            MemoryPoolItem *old_first = first_item_;
-
-            // Is pool empty?
-            if (old_first == nullptr)
+#endif
+            // Obtains memory for byte_count bytes of data of alloc as requested 
+            // by options; alloc is a pool head allocation or an arena chunk, of 
+            // which only data_ptr, mapped_byte_count and pages are set
+            template<typename Slab>
+            void allocate_allocation_data(Slab &alloc, 
+                size_t byte_count, const MemoryPoolOptions &options)
             {
-                allocation &last_alloc = allocs_.back();
-                MemoryPoolItem *new_item = nullptr;
-                if (last_alloc.free > 0)
+                if (options.quota && !options.quota->try_charge(byte_count))
                 {
-                    // Pool is empty; there is memory
-                    new_item = new MemoryPoolItem(last_alloc.head_ptr);
-                    last_alloc.free--;
-                    last_alloc.head_ptr += item_byte_count_;
+                    throw bad_alloc();
                 }
-                else
+                try
                 {
-                    // Pool is empty; there is no memory
-                    allocation new_alloc;
-
-                    // Increase allocation size unless we are already at max
-                    size_t new_size = safe_cast<size_t>(
-                        ceil(MemoryPool::alloc_size_multiplier * 
-                            static_cast<double>(last_alloc.size)));
-                    size_t new_alloc_byte_count = mul_safe(new_size, item_byte_count_);
-                    if (new_alloc_byte_count > 
-                        MemoryPool::max_batch_alloc_byte_count)
+                    alloc.mapped_byte_count = 0;
+                    if (options.slab_provider)
                     {
-                        new_size = last_alloc.size;
-                        new_alloc_byte_count = new_size * item_byte_count_;
+                        alloc.data_ptr = options.slab_provider->allocate(
+                            byte_count, options.alignment, alloc.pages);
+                        return;
                     }
-
-                    try
+#if defined(__linux__)
+                    if (options.pages != page_type::standard || options.numa_node >= 0 ||
+                        (options.debug.enabled && options.debug.guard_pages))
                     {
-                        new_alloc.data_ptr = new SEAL_BYTE[new_alloc_byte_count];
+                        map_allocation_data(alloc, byte_count, options);
+                        return;
                     }
-                    catch (const bad_alloc &)
+#endif
+                    alloc.data_ptr = static_cast<SEAL_BYTE*>(::operator new[](
+                        byte_count, align_val_t(options.alignment)));
+                    alloc.pages = page_type::standard;
+                }
+                catch (...)
+                {
+                    // Allocation failed; rethrow
+                    if (options.quota)
                     {
-                        // Allocation failed; rethrow
-                        throw;
+                        options.quota->refund(byte_count);
                     }
-
-                    new_alloc.size = new_size;
-                    new_alloc.free = new_size - 1;
-                    new_alloc.head_ptr = new_alloc.data_ptr + item_byte_count_;
-                    allocs_.push_back(new_alloc);
-                    item_count_ += new_size;
-                    new_item = new MemoryPoolItem(new_alloc.data_ptr);
+                    throw;
                 }
-
-                locked_.store(false, memory_order_release);
-                return new_item;
             }
 
-            // Pool is not empty
-            first_item_ = old_first->next();
-            old_first->next() = nullptr;
-            locked_.store(false, memory_order_release);
-            return old_first;
-        }
-
-        MemoryPoolHeadST::MemoryPoolHeadST(size_t item_byte_count,
-            bool clear_on_destruction) :
-            clear_on_destruction_(clear_on_destruction),
-            item_byte_count_(item_byte_count), 
-            item_count_(MemoryPool::first_alloc_count), 
-            first_item_(nullptr)
-        {
-            if ((item_byte_count_ == 0) || 
-                (item_byte_count_ > MemoryPool::max_batch_alloc_byte_count) ||
-                (mul_safe(item_byte_count_, MemoryPool::first_alloc_count) > 
-                    MemoryPool::max_batch_alloc_byte_count))
+            // Releases the byte_count bytes of data of alloc
+            template<typename Slab>
+            void free_allocation_data(Slab &alloc, 
+                size_t byte_count, const MemoryPoolOptions &options) noexcept
             {
-                throw invalid_argument("invalid allocation size");
+                if (options.quota)
+                {
+                    options.quota->refund(byte_count);
+                }
+                if (options.slab_provider)
+                {
+                    options.slab_provider->deallocate(
+                        alloc.data_ptr, byte_count, options.alignment);
+                    alloc.data_ptr = nullptr;
+                    return;
+                }
+#if defined(__linux__)
+                if (alloc.mapped_byte_count)
+                {
+                    // With a guard page the data does not start the mapping
+                    size_t page_byte_count = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                    munmap(reinterpret_cast<SEAL_BYTE*>(
+                        reinterpret_cast<uintptr_t>(alloc.data_ptr) & ~(page_byte_count - 1)), 
+                        alloc.mapped_byte_count);
+                    alloc.data_ptr = nullptr;
+                    return;
+                }
+#endif
+                ::operator delete[](alloc.data_ptr, align_val_t(options.alignment));
+                alloc.data_ptr = nullptr;
             }
 
-            // Initial allocation
-            allocation new_alloc;
-            try
+            // Pads item_byte_count to a multiple of the given alignment
+            size_t aligned_item_stride(size_t item_byte_count, size_t alignment)
             {
-                new_alloc.data_ptr = new SEAL_BYTE[
-                    mul_safe(MemoryPool::first_alloc_count, item_byte_count_)];
+                if (!alignment || (alignment & (alignment - 1)) || 
+                    alignment > max_pool_alignment)
+                {
+                    throw invalid_argument("invalid alignment");
+                }
+                return add_safe(item_byte_count, alignment - 1) & ~(alignment - 1);
             }
-            catch (const bad_alloc &)
+
+            // Allocates memory for item_count items placed item_stride bytes apart 
+            // together with the item records for them. The item records are 
+            // constructed lazily when items are first handed out.
+            MemoryPoolHead::allocation new_allocation(size_t item_count, 
+                size_t item_stride, const MemoryPoolOptions &options)
             {
-                // Allocation failed; rethrow
-                throw;
-            }
+                MemoryPoolHead::allocation new_alloc;
+                allocate_allocation_data(new_alloc, 
+                    mul_safe(item_count, item_stride), options);
+                try
+                {
+                    new_alloc.item_ptr = static_cast<MemoryPoolItem*>(
+                        ::operator new(mul_safe(item_count, sizeof(MemoryPoolItem))));
+                }
+                catch (const bad_alloc &)
+                {
+                    // Allocation failed; release data and rethrow
+                    free_allocation_data(new_alloc, 
+                        mul_safe(item_count, item_stride), options);
+                    throw;
+                }
 
-            new_alloc.size = MemoryPool::first_alloc_count;
-            new_alloc.free = MemoryPool::first_alloc_count;
-            new_alloc.head_ptr = new_alloc.data_ptr;
-            allocs_.clear();
-            allocs_.push_back(new_alloc);
-        }
+                new_alloc.size = item_count;
+                new_alloc.free = item_count;
+                new_alloc.head_ptr = new_alloc.data_ptr;
+                if (options.debug.enabled)
+                {
+                    // Items not yet handed out are treated like released ones
+                    size_t byte_count = item_count * item_stride;
+                    if (options.debug.poison)
+                    {
+                        memset(new_alloc.data_ptr, MemoryPoolDebugOptions::poison_byte, 
+                            byte_count);
+                    }
+                    ASAN_POISON_MEMORY_REGION(new_alloc.data_ptr, byte_count);
+                }
+                return new_alloc;
+            }
 
-        MemoryPoolHeadST::~MemoryPoolHeadST() noexcept
-        {
-            // Delete the items (but not the memory)
-            MemoryPoolItem *curr_item = first_item_;
-            while(curr_item)
+            // Poisons the data of an item that is returned in debug mode
+            void release_item_data(MemoryPoolItem *item, size_t item_stride,
+                const MemoryPoolOptions &options) noexcept
             {
-                MemoryPoolItem *next_item = curr_item->next();
-                delete curr_item;
-                curr_item = next_item;
+                // The padding was left inaccessible when the item was handed out
+                ASAN_UNPOISON_MEMORY_REGION(item->data(), item_stride);
+                if (options.debug.poison)
+                {
+                    memset(item->data(), MemoryPoolDebugOptions::poison_byte, item_stride);
+                }
+                else if (options.wipe_on_release)
+                {
+                    secure_zero(item->data(), item_stride);
+                }
+                ASAN_POISON_MEMORY_REGION(item->data(), item_stride);
             }
-            first_item_ = nullptr;
 
-            if (clear_on_destruction_)
+            // Makes the data of an item accessible again in debug mode; throws 
+            // std::logic_error if it was modified since it was poisoned
+            void reuse_item_data(MemoryPoolItem *item, size_t item_byte_count, 
+                size_t item_stride, const MemoryPoolOptions &options)
             {
-                // Delete the memory
-                for (auto &alloc : allocs_)
+                SEAL_BYTE *data = item->data();
+                ASAN_UNPOISON_MEMORY_REGION(data, item_stride);
+                bool modified = false;
+                if (options.debug.poison)
                 {
-                    // Do we need to clear the memory?
-                    if (clear_on_destruction_)
+                    for (size_t i = 0; i < item_stride; i++)
                     {
-                        std::size_t curr_alloc_byte_count = mul_safe(item_byte_count_, alloc.size);
-                        volatile SEAL_BYTE *data_ptr = reinterpret_cast<SEAL_BYTE*>(alloc.data_ptr);
-                        while (curr_alloc_byte_count--)
+                        if (data[i] != static_cast<SEAL_BYTE>(
+                            MemoryPoolDebugOptions::poison_byte))
                         {
-                            *data_ptr++ = static_cast<SEAL_BYTE>(0);
+                            modified = true;
+                            break;
                         }
                     }
-
-                    // Delete this allocation
-                    delete[] alloc.data_ptr;
                 }
-            }
-            else
-            {
-                // Delete the memory
-                for (auto &alloc : allocs_)
+
+                // Keep the padding inaccessible
+                ASAN_POISON_MEMORY_REGION(data + item_byte_count, 
+                    item_stride - item_byte_count);
+                if (modified)
                 {
-                    // Delete this allocation
-                    delete[] alloc.data_ptr;
+                    throw logic_error("memory pool item modified after release");
                 }
             }
 
-            allocs_.clear();
-        }
-
-        MemoryPoolItem *MemoryPoolHeadST::get()
-        {
-            MemoryPoolItem *old_first = first_item_;
-
-            // Is pool empty?
-            if (old_first == nullptr)
+            // Recomputes the number of bytes backed by each kind of pages
+            void count_page_bytes(const vector<MemoryPoolHead::allocation> &allocs,
+                size_t item_stride, atomic<size_t> *page_byte_counts) noexcept
             {
-                allocation &last_alloc = allocs_.back();
-                MemoryPoolItem *new_item = nullptr;
-                if (last_alloc.free > 0)
+                size_t counts[page_type_count]{};
+                for (auto &alloc : allocs)
                 {
-                    // Pool is empty; there is memory
-                    new_item = new MemoryPoolItem(last_alloc.head_ptr);
-                    last_alloc.free--;
-                    last_alloc.head_ptr += item_byte_count_;
+                    counts[static_cast<int>(alloc.pages)] += alloc.size * item_stride;
                 }
-                else
+                for (int i = 0; i < page_type_count; i++)
                 {
-                    // Pool is empty; there is no memory
-                    allocation new_alloc;
+                    page_byte_counts[i].store(counts[i], memory_order_relaxed);
+                }
+            }
 
-                    // Increase allocation size unless we are already at max
-                    size_t new_size = safe_cast<size_t>(
-                        ceil(MemoryPool::alloc_size_multiplier * 
-                            static_cast<double>(last_alloc.size)));
-                    size_t new_alloc_byte_count = mul_safe(new_size, item_byte_count_);
-                    if (new_alloc_byte_count > 
-                        MemoryPool::max_batch_alloc_byte_count)
-                    {
-                        new_size = last_alloc.size;
-                        new_alloc_byte_count = new_size * item_byte_count_;
-                    }
+            // Takes the next unused item from an allocation that has free space
+            inline MemoryPoolItem *carve_item(
+                MemoryPoolHead::allocation &alloc, size_t item_stride) noexcept
+            {
+                MemoryPoolItem *new_item = new(
+                    alloc.item_ptr + (alloc.size - alloc.free)) 
+                    MemoryPoolItem(alloc.head_ptr);
+                alloc.free--;
+                alloc.head_ptr += item_stride;
+                return new_item;
+            }
 
-                    try
+            // Carves all remaining items of an allocation into a chain; returns the 
+            // first item of the chain (or nullptr) and sets last_item to the last one
+            MemoryPoolItem *carve_remaining_items(MemoryPoolHead::allocation &alloc,
+                size_t item_stride, MemoryPoolItem *&last_item) noexcept
+            {
+                MemoryPoolItem *first_item = nullptr;
+                last_item = nullptr;
+                while (alloc.free)
+                {
+                    MemoryPoolItem *item = carve_item(alloc, item_stride);
+                    if (last_item)
                     {
-                        new_alloc.data_ptr = new SEAL_BYTE[new_alloc_byte_count];
+                        last_item->set_next(item);
                     }
-                    catch (const bad_alloc &)
+                    else
                     {
-                        // Allocation failed; rethrow
-                        throw;
+                        first_item = item;
                     }
-
-                    new_alloc.size = new_size;
-                    new_alloc.free = new_size - 1;
-                    new_alloc.head_ptr = new_alloc.data_ptr + item_byte_count_;
-                    allocs_.push_back(new_alloc);
-                    item_count_ += new_size;
-                    new_item = new MemoryPoolItem(new_alloc.data_ptr);
+                    last_item = item;
                 }
-
-                return new_item;
+                return first_item;
             }
 
-            // Pool is not empty
-            first_item_ = old_first->next();
-            old_first->next() = nullptr;
-            return old_first;
-        }
-
-        const size_t MemoryPool::max_single_alloc_byte_count = 
-            []() -> size_t {
-                int bit_shift = static_cast<int>(
-                    ceil(log2(MemoryPool::alloc_size_multiplier)));
-                if (bit_shift < 0 || unsigned_geq(bit_shift, 
-                    sizeof(size_t) * static_cast<size_t>(bits_per_byte)))
-                {
-                    throw logic_error("alloc_size_multiplier too large");
-                }
-                return numeric_limits<size_t>::max() >> bit_shift;
-            }();
-
-        const size_t MemoryPool::max_batch_alloc_byte_count =
-            []() -> size_t {
-                int bit_shift = static_cast<int>(
-                    ceil(log2(MemoryPool::alloc_size_multiplier)));
-                if (bit_shift < 0 || unsigned_geq(bit_shift, 
-                    sizeof(size_t) * static_cast<size_t>(bits_per_byte)))
+            void delete_allocation_data(MemoryPoolHead::allocation &alloc, 
+                size_t item_stride, bool clear, const MemoryPoolOptions &options) noexcept
+            {
+                // Do we need to clear the memory?
+                size_t byte_count = mul_safe(item_stride, alloc.size);
+                ASAN_UNPOISON_MEMORY_REGION(alloc.data_ptr, byte_count);
+                if (clear)
                 {
-                    throw logic_error("alloc_size_multiplier too large");
+                    secure_zero(alloc.data_ptr, byte_count);
                 }
-                return numeric_limits<size_t>::max() >> bit_shift;
-            }();
 
-        MemoryPoolMT::~MemoryPoolMT() noexcept
-        {
-            WriterLock lock(pools_locker_.acquire_write());
-            for(MemoryPoolHead *head : pools_)
-            {
-                delete head;
+                free_allocation_data(alloc, byte_count, options);
             }
-            pools_.clear();
-        }
 
-        Pointer<SEAL_BYTE> MemoryPoolMT::get_for_byte_count(size_t byte_count)
-        {
-            if (byte_count > max_single_alloc_byte_count)
-            {
-                throw invalid_argument("invalid allocation size");
-            }
-            else if (byte_count == 0)
+            void delete_allocation(MemoryPoolHead::allocation &alloc, 
+                size_t item_stride, bool clear, const MemoryPoolOptions &options) noexcept
             {
-                return Pointer<SEAL_BYTE>();
+                // Delete this allocation; the item records are trivially destructible
+                delete_allocation_data(alloc, item_stride, clear, options);
+                ::operator delete(alloc.item_ptr);
+                alloc.item_ptr = nullptr;
             }
 
-            // Attempt to find size.
-            ReaderLock reader_lock(pools_locker_.acquire_read());
-            size_t start = 0;
-            size_t end = pools_.size();
-            while (start < end)
+            /*
+            Releases allocations all of whose items are either on the given free 
+            list or not yet handed out, most recent first, until at least byte_count 
+            bytes have been released. The free list is updated to hold only items 
+            of the remaining allocations. If retired_item_ptrs is given the item 
+            records of released allocations are moved there instead of freed.
+            Throws only before anything is modified.
+            */
+            size_t release_free_allocations(vector<MemoryPoolHead::allocation> &allocs,
+                MemoryPoolItem *&free_items, size_t byte_count, size_t item_stride, 
+                bool clear, const MemoryPoolOptions &options, 
+                vector<MemoryPoolItem*> *retired_item_ptrs)
             {
-                size_t mid = (start + end) / 2;
-                MemoryPoolHead *mid_head = pools_[mid];
-                size_t mid_byte_count = mid_head->item_byte_count();
-                if (byte_count < mid_byte_count)
+                // Map item records to their allocations by address
+                vector<pair<const MemoryPoolItem*, size_t>> ranges;
+                ranges.reserve(allocs.size());
+                for (size_t i = 0; i < allocs.size(); i++)
                 {
-                    start = mid + 1;
+                    ranges.emplace_back(allocs[i].item_ptr, i);
                 }
-                else if (byte_count > mid_byte_count)
+                sort(ranges.begin(), ranges.end());
+                auto alloc_index = [&ranges](const MemoryPoolItem *item) {
+                    return prev(upper_bound(ranges.cbegin(), ranges.cend(), 
+                        make_pair(item, numeric_limits<size_t>::max())))->second;
+                };
+
+                // Count the free items of each allocation
+                vector<size_t> free_counts(allocs.size());
+                for (size_t i = 0; i < allocs.size(); i++)
                 {
-                    end = mid;
+                    free_counts[i] = allocs[i].free;
                 }
-                else
+                for (MemoryPoolItem *item = free_items; item; item = item->next())
+                {
+                    free_counts[alloc_index(item)]++;
+                }
+
+                // Select allocations to release
+                vector<bool> release(allocs.size(), false);
+                size_t release_count = 0;
+                size_t released_byte_count = 0;
+                for (size_t i = allocs.size(); i-- > 0 && released_byte_count < byte_count;)
+                {
+                    if (free_counts[i] == allocs[i].size)
+                    {
+                        release[i] = true;
+                        release_count++;
+                        released_byte_count = add_safe(released_byte_count, 
+                            mul_safe(allocs[i].size, item_stride));
+                    }
+                }
+                if (!release_count)
+                {
+                    return 0;
+                }
+                if (retired_item_ptrs)
+                {
+                    retired_item_ptrs->reserve(add_safe(
+                        retired_item_ptrs->size(), release_count));
+                }
+
+                // Unlink the items of released allocations
+                MemoryPoolItem *kept_item = nullptr;
+                for (MemoryPoolItem *item = free_items; item; item = item->next())
+                {
+                    if (!release[alloc_index(item)])
+                    {
+                        kept_item = item;
+                    }
+                    else if (kept_item)
+                    {
+                        kept_item->set_next(item->next());
+                    }
+                    else
+                    {
+                        free_items = item->next();
+                    }
+                }
+
+                // Release the memory
+                size_t kept = 0;
+                for (size_t i = 0; i < allocs.size(); i++)
                 {
-                    return Pointer<SEAL_BYTE>(mid_head);
+                    if (!release[i])
+                    {
+                        allocs[kept++] = allocs[i];
+                    }
+                    else if (retired_item_ptrs)
+                    {
+                        delete_allocation_data(allocs[i], item_stride, clear, options);
+                        retired_item_ptrs->push_back(allocs[i].item_ptr);
+                    }
+                    else
+                    {
+                        delete_allocation(allocs[i], item_stride, clear, options);
+                    }
                 }
+                allocs.resize(kept);
+                return released_byte_count;
             }
-            reader_lock.unlock();
 
-            // Size was not found, so obtain an exclusive lock and search again.
-            WriterLock writer_lock(pools_locker_.acquire_write());
-            start = 0;
-            end = pools_.size();
-            while (start < end)
+            void validate_growth(const SlabGrowthPolicy &growth)
             {
-                size_t mid = (start + end) / 2;
-                MemoryPoolHead *mid_head = pools_[mid];
-                size_t mid_byte_count = mid_head->item_byte_count();
-                if (byte_count < mid_byte_count)
+                if (!isfinite(growth.growth_factor) || growth.growth_factor < 1.0)
                 {
-                    start = mid + 1;
+                    throw invalid_argument("invalid growth_factor");
                 }
-                else if (byte_count > mid_byte_count)
+                if (growth.min_slab_byte_count > growth.max_slab_byte_count)
                 {
-                    end = mid;
+                    throw invalid_argument("min_slab_byte_count exceeds max_slab_byte_count");
                 }
-                else
+            }
+
+            void validate_lock_wait(const LockWaitPolicy &lock_wait)
+            {
+                if (lock_wait.spin_round_count > LockWaitPolicy::max_spin_round_count)
                 {
-                    return Pointer<SEAL_BYTE>(mid_head);
+                    throw invalid_argument("spin_round_count is too large");
                 }
             }
 
-            // Size was still not found, but we own an exclusive lock so just add it,
-            // but first check if we are at maximum pool head count already.
-            if (pools_.size() >= max_pool_head_count)
+            // Tells the processor that the thread is spinning, which saves 
+            // power and frees execution resources for a sibling hyperthread
+            inline void cpu_pause() noexcept
             {
-                throw runtime_error("maximum pool head count reached");
+#if defined(SEAL_USE_INTRIN) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__))
+                _mm_pause();
+#elif defined(__aarch64__)
+                __asm__ __volatile__("yield");
+#endif
             }
 
-            MemoryPoolHead *new_head = new MemoryPoolHeadMT(byte_count, clear_on_destruction_);
-            if (!pools_.empty())
+            inline void yield_thread() noexcept
             {
-                pools_.insert(pools_.begin() + static_cast<ptrdiff_t>(start), new_head);
+#ifndef _M_CEE
+                this_thread::yield();
+#endif
             }
-            else
+
+#if defined(__linux__)
+            static_assert(sizeof(atomic<uint32_t>) == sizeof(uint32_t), 
+                "futex word must be a plain 32-bit integer");
+
+            // Sleeps while the word at state equals value; may return spuriously
+            inline void futex_wait(atomic<uint32_t> &state, uint32_t value) noexcept
             {
-                pools_.emplace_back(new_head);
+                syscall(SYS_futex, reinterpret_cast<uint32_t*>(&state), 
+                    FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
             }
 
-            return Pointer<SEAL_BYTE>(new_head);
-        }
+            inline void futex_wake_one(atomic<uint32_t> &state) noexcept
+            {
+                syscall(SYS_futex, reinterpret_cast<uint32_t*>(&state), 
+                    FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+            }
+#endif
 
-        size_t MemoryPoolMT::alloc_byte_count() const
-        {
-            ReaderLock lock(pools_locker_.acquire_read());
+            // Largest number of items in an allocation
+            size_t max_allocation_size(size_t item_stride, 
+                const SlabGrowthPolicy &growth) noexcept
+            {
+                return max(size_t(1), min(growth.max_slab_byte_count, 
+                    MemoryPool::max_batch_alloc_byte_count) / item_stride);
+            }
 
+            // Size of the first allocation of a pool head
+            size_t first_allocation_size(size_t item_stride, 
+                const SlabGrowthPolicy &growth) noexcept
+            {
+                return min(max(MemoryPool::first_alloc_count, 
+                    growth.min_slab_byte_count / item_stride), 
+                    max_allocation_size(item_stride, growth));
+            }
+
+            // Size of the next allocation for a pool head whose last allocation 
+            // held last_size items
+            size_t next_allocation_size(size_t last_size, size_t item_stride, 
+                const SlabGrowthPolicy &growth) noexcept
+            {
+                // Increase allocation size unless we are already at max
+                size_t max_size = max_allocation_size(item_stride, growth);
+                double new_size = ceil(growth.growth_factor * static_cast<double>(last_size));
+                if (new_size >= static_cast<double>(max_size))
+                {
+                    return max_size;
+                }
+                return max(static_cast<size_t>(new_size), 
+                    first_allocation_size(item_stride, growth));
+            }
+        }
+
+        bool MemoryPoolQuota::try_charge(size_t byte_count) noexcept
+        {
+            size_t old_byte_count = byte_count_.load(memory_order_relaxed);
+            size_t new_byte_count;
+            do
+            {
+                new_byte_count = old_byte_count + byte_count;
+                if (new_byte_count < old_byte_count || 
+                    new_byte_count > byte_limit_.load(memory_order_relaxed))
+                {
+                    rejected_count_.fetch_add(1, memory_order_relaxed);
+                    return false;
+                }
+            } while (!byte_count_.compare_exchange_weak(old_byte_count, 
+                new_byte_count, memory_order_relaxed));
+
+            size_t peak = peak_byte_count_.load(memory_order_relaxed);
+            while (new_byte_count > peak && !peak_byte_count_.compare_exchange_weak(
+                peak, new_byte_count, memory_order_relaxed));
+            return true;
+        }
+
+        SEAL_BYTE *MemoryPoolSlabProviderNew::allocate(size_t byte_count, 
+            size_t alignment, page_type &pages)
+        {
+            auto data = static_cast<SEAL_BYTE*>(
+                ::operator new[](byte_count, align_val_t(alignment)));
+            pages = page_type::standard;
+            return data;
+        }
+
+        void MemoryPoolSlabProviderNew::deallocate(SEAL_BYTE *data, 
+            size_t, size_t alignment) noexcept
+        {
+            ::operator delete[](data, align_val_t(alignment));
+        }
+
+        SEAL_BYTE *MemoryPoolSlabProviderMmap::allocate(size_t byte_count, 
+            size_t alignment, page_type &pages)
+        {
+#if defined(__linux__)
+            // Mappings are page-aligned, which satisfies any pool alignment
+            (void)alignment;
+            return map_data(byte_count, pages_, numa_node_, pages);
+#else
+            auto data = static_cast<SEAL_BYTE*>(
+                ::operator new[](byte_count, align_val_t(alignment)));
+            pages = page_type::standard;
+            return data;
+#endif
+        }
+
+        void MemoryPoolSlabProviderMmap::deallocate(SEAL_BYTE *data, 
+            size_t byte_count, size_t alignment) noexcept
+        {
+#if defined(__linux__)
+            (void)alignment;
+            munmap(data, mapped_byte_count(byte_count, pages_));
+#else
+            (void)byte_count;
+            ::operator delete[](data, align_val_t(alignment));
+#endif
+        }
+
+        MemoryPoolSlabProviderRegion::MemoryPoolSlabProviderRegion(void *data, 
+            size_t byte_count, page_type pages) : 
+            data_(static_cast<SEAL_BYTE*>(data)), pages_(pages)
+        {
+            if (!data && byte_count)
+            {
+                throw invalid_argument("data");
+            }
+            if (byte_count)
+            {
+                free_ranges_.emplace(0, byte_count);
+            }
+        }
+
+        SEAL_BYTE *MemoryPoolSlabProviderRegion::allocate(size_t byte_count, 
+            size_t alignment, page_type &pages)
+        {
+            auto lock = free_locker_.acquire_write();
+
+            // First fit; the padding needed for alignment stays free
+            for (auto it = free_ranges_.begin(); it != free_ranges_.end(); ++it)
+            {
+                size_t address = reinterpret_cast<uintptr_t>(data_) + it->first;
+                size_t padding = ((address + alignment - 1) & ~(alignment - 1)) - address;
+                if (it->second < padding || it->second - padding < byte_count)
+                {
+                    continue;
+                }
+                size_t offset = it->first + padding;
+                size_t tail_byte_count = it->second - padding - byte_count;
+                if (padding)
+                {
+                    it->second = padding;
+                }
+                else
+                {
+                    free_ranges_.erase(it);
+                }
+                if (tail_byte_count)
+                {
+                    free_ranges_.emplace(offset + byte_count, tail_byte_count);
+                }
+                pages = pages_;
+                return data_ + offset;
+            }
+            throw bad_alloc();
+        }
+
+        void MemoryPoolSlabProviderRegion::deallocate(SEAL_BYTE *data, 
+            size_t byte_count, size_t) noexcept
+        {
+            if (!byte_count)
+            {
+                return;
+            }
+            auto lock = free_locker_.acquire_write();
+            size_t offset = static_cast<size_t>(data - data_);
+
+            // Merge with the free ranges right after and right before
+            auto next = free_ranges_.lower_bound(offset);
+            if (next != free_ranges_.end() && next->first == offset + byte_count)
+            {
+                byte_count += next->second;
+                next = free_ranges_.erase(next);
+            }
+            if (next != free_ranges_.begin())
+            {
+                auto prev = std::prev(next);
+                if (prev->first + prev->second == offset)
+                {
+                    prev->second += byte_count;
+                    return;
+                }
+            }
+            free_ranges_.emplace_hint(next, offset, byte_count);
+        }
+
+        size_t MemoryPoolSlabProviderRegion::free_byte_count() const
+        {
+            auto lock = free_locker_.acquire_read();
+            size_t result = 0;
+            for (auto &range : free_ranges_)
+            {
+                result += range.second;
+            }
+            return result;
+        }
+
+        void secure_zero(void *data, size_t byte_count) noexcept
+        {
+            if (!byte_count)
+            {
+                return;
+            }
+#if defined(__GLIBC__) && \
+    ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 25)))
+            explicit_bzero(data, byte_count);
+#elif (SEAL_COMPILER == SEAL_COMPILER_GCC) || (SEAL_COMPILER == SEAL_COMPILER_CLANG)
+            // The library memset uses the widest stores available; the barrier 
+            // makes the compiler assume the zeroed memory is read afterwards
+            memset(data, 0, byte_count);
+            __asm__ __volatile__("" : : "r"(data) : "memory");
+#else
+            // Calling through a volatile pointer cannot be optimized away
+            static void *(*const volatile memset_ptr)(void*, int, size_t) = memset;
+            memset_ptr(data, 0, byte_count);
+#endif
+        }
+
+#ifdef SEAL_MEMPOOL_TRACE
+        namespace
+        {
+            atomic<mempool_trace_hook> trace_hook{ nullptr };
+        }
+
+        void set_mempool_trace_hook(mempool_trace_hook hook) noexcept
+        {
+            trace_hook.store(hook, memory_order_release);
+        }
+
+        void trace_mempool_event(mempool_event event, 
+            const MemoryPoolHead &head) noexcept
+        {
+            mempool_trace_hook hook = trace_hook.load(memory_order_acquire);
+            if (hook)
+            {
+                hook(event, head);
+            }
+        }
+
+#endif
+        void MemoryPoolHead::get_batch(MemoryPoolItem **items, size_t item_count)
+        {
+            size_t count = 0;
+            try
+            {
+                for (; count < item_count; count++)
+                {
+                    items[count] = get();
+                }
+            }
+            catch (...)
+            {
+                while (count--)
+                {
+                    add(items[count]);
+                }
+                throw;
+            }
+        }
+
+        void MemoryPoolHead::add_batch(MemoryPoolItem *first, MemoryPoolItem *, 
+            size_t item_count) noexcept
+        {
+            while (item_count--)
+            {
+                MemoryPoolItem *next = first->next();
+                add(first);
+                first = next;
+            }
+        }
+
+        MemoryPoolHeadMT::MemoryPoolHeadMT(size_t item_byte_count,
+            bool clear_on_destruction, const MemoryPoolOptions &options) :
+            clear_on_destruction_(clear_on_destruction), options_(options),
+            item_byte_count_(item_byte_count), 
+            item_stride_(aligned_item_stride(item_byte_count, options.alignment)),
+            item_count_(MemoryPool::first_alloc_count), alloc_count_(1),
+            first_item_(0)
+        {
+            if ((item_byte_count_ == 0) || 
+                (item_stride_ > MemoryPool::max_batch_alloc_byte_count) ||
+                (mul_safe(item_stride_, MemoryPool::first_alloc_count) > 
+                    MemoryPool::max_batch_alloc_byte_count))
+            {
+                throw invalid_argument("invalid allocation size");
+            }
+            validate_growth(options_.growth);
+            validate_lock_wait(options_.lock_wait);
+
+            // Initial allocation
+            allocs_.clear();
+            allocs_.push_back(new_allocation(
+                first_allocation_size(item_stride_, options_.growth), 
+                item_stride_, options_));
+            item_count_.store(allocs_.back().size, memory_order_relaxed);
+            count_page_bytes(allocs_, item_stride_, page_byte_counts_);
+        }
+
+        void MemoryPoolHeadMT::lock() noexcept
+        {
+            auto &state = locked_.state;
+            uint32_t expected = lock_free;
+            if (state.compare_exchange_strong(expected, lock_held, memory_order_acquire))
+            {
+#ifdef SEAL_LOCK_PROFILE
+                held_since_ = profile_.record_acquire(LockProfile::clock::time_point());
+#endif
+                return;
+            }
+
+            auto start = chrono::steady_clock::now();
+            const LockWaitPolicy &policy = options_.lock_wait;
+            uint32_t round = 0;
+            while (true)
+            {
+                // Only read the lock while it is held, so that waiters do not 
+                // take the cache line away from the holder
+                expected = state.load(memory_order_relaxed);
+                if (expected == lock_free && state.compare_exchange_weak(
+                    expected, lock_held, memory_order_acquire, memory_order_relaxed))
+                {
+                    break;
+                }
+                if (round < policy.spin_round_count || policy.wait == lock_wait_type::spin)
+                {
+                    for (uint32_t i = uint32_t(1) << round; i; i--)
+                    {
+                        cpu_pause();
+                    }
+                    if (round < policy.spin_round_count)
+                    {
+                        round++;
+                    }
+                    continue;
+                }
+#if defined(__linux__)
+                if (policy.wait == lock_wait_type::park)
+                {
+                    // Once parked, always take the lock as contended: the 
+                    // thread cannot tell whether others are still parked
+                    while (state.exchange(lock_contended, memory_order_acquire) != lock_free)
+                    {
+                        futex_wait(state, lock_contended);
+                    }
+                    break;
+                }
+#endif
+                yield_thread();
+            }
+            auto end = chrono::steady_clock::now();
+            spin_time_.fetch_add(chrono::duration_cast<chrono::nanoseconds>(
+                end - start).count(), memory_order_relaxed);
+#ifdef SEAL_LOCK_PROFILE
+            held_since_ = end;
+            profile_.record_wait(end - start);
+#endif
+        }
+
+        void MemoryPoolHeadMT::wake_lock_waiter() noexcept
+        {
+#if defined(__linux__)
+            futex_wake_one(locked_.state);
+#endif
+        }
+
+        MemoryPoolHeadMT::~MemoryPoolHeadMT() noexcept
+        {
+            lock();
+
+            // The items live in the allocations so there is nothing to delete
+            first_item_.store(0, memory_order_relaxed);
+
+            // Delete the memory
+            for (auto &alloc : allocs_)
+            {
+                delete_allocation(alloc, item_stride_, clear_on_destruction_, options_);
+            }
+            for (auto item_ptr : retired_item_ptrs_)
+            {
+                ::operator delete(item_ptr);
+            }
+
+            allocs_.clear();
+            retired_item_ptrs_.clear();
+        }
+
+        MemoryPoolItem *MemoryPoolHeadMT::get()
+        {
+            MemoryPoolItem *item = get_item();
+            if (options_.debug.enabled)
+            {
+                reuse_item_data(item, item_byte_count_, item_stride_, options_);
+            }
+            return item;
+        }
+
+        void MemoryPoolHeadMT::add_debug(MemoryPoolItem *new_first) noexcept
+        {
+            add_count_.fetch_add(1, memory_order_relaxed);
+            SEAL_MEMPOOL_TRACE_EVENT(add, *this);
+            release_item_data(new_first, item_stride_, options_);
+
+            lock();
+            MemoryPoolItem *oldest = quarantine_.push(
+                new_first, options_.debug.quarantine_item_count);
+            unlock();
+            if (oldest)
+            {
+                add_chain(oldest, oldest);
+            }
+        }
+
+        MemoryPoolItem *MemoryPoolHeadMT::get_item()
+        {
+            // Fast path: lock-free pop from the free list
+            MemoryPoolItem *item = try_pop();
+            if (item)
+            {
+                count_get();
+                return item;
+            }
+
+            // Pool is empty; lock for carving or growing the allocations
+            lock();
+
+            // Items may have been returned while we were waiting
+            item = try_pop();
+            if (item)
+            {
+                unlock();
+                count_get();
+                return item;
+            }
+
+            if (allocs_.empty() || allocs_.back().free == 0)
+            {
+                // Pool is empty; there is no memory (or all of it was trimmed)
+                try
+                {
+                    grow();
+                }
+                catch (...)
+                {
+                    unlock();
+                    throw;
+                }
+            }
+
+            // Pool is empty; there is memory
+            item = carve_item(allocs_.back(), item_stride_);
+
+            unlock();
+            count_get();
+            return item;
+        }
+
+        size_t MemoryPoolHeadMT::try_pop_chain(MemoryPoolItem **items, 
+            size_t item_count) noexcept
+        {
+            tagged_item_ptr old_first = first_item_.load(memory_order_acquire);
+            while (true)
+            {
+                // The items are only consistent if the compare-exchange succeeds
+                size_t count = 0;
+                MemoryPoolItem *item = untag(old_first);
+                while (item && count < item_count)
+                {
+                    items[count++] = item;
+                    item = item->next();
+                }
+                if (count == 0)
+                {
+                    return 0;
+                }
+                if (first_item_.compare_exchange_weak(old_first, 
+                    retag(item, old_first), memory_order_acquire, 
+                    memory_order_acquire))
+                {
+                    for (size_t i = 0; i < count; i++)
+                    {
+                        items[i]->set_next(nullptr);
+                    }
+                    return count;
+                }
+            }
+        }
+
+        void MemoryPoolHeadMT::take_items(MemoryPoolItem **items, size_t item_count)
+        {
+            size_t count = try_pop_chain(items, item_count);
+            if (count == item_count)
+            {
+                return;
+            }
+
+            lock();
+            try
+            {
+                count += try_pop_chain(items + count, item_count - count);
+                while (count < item_count)
+                {
+                    if (allocs_.empty() || allocs_.back().free == 0)
+                    {
+                        grow();
+                    }
+                    items[count++] = carve_item(allocs_.back(), item_stride_);
+                }
+            }
+            catch (...)
+            {
+                unlock();
+
+                // Return the items taken so far
+                for (size_t i = 1; i < count; i++)
+                {
+                    items[i - 1]->set_next(items[i]);
+                }
+                if (count)
+                {
+                    add_chain(items[0], items[count - 1]);
+                }
+                throw;
+            }
+            unlock();
+        }
+
+        void MemoryPoolHeadMT::grow()
+        {
+            allocs_.push_back(new_allocation(allocs_.empty() ? 
+                first_allocation_size(item_stride_, options_.growth) :
+                next_allocation_size(allocs_.back().size, item_stride_, 
+                    options_.growth), 
+                item_stride_, options_));
+            item_count_.fetch_add(allocs_.back().size, memory_order_relaxed);
+            alloc_count_.fetch_add(1, memory_order_relaxed);
+            count_page_bytes(allocs_, item_stride_, page_byte_counts_);
+            SEAL_MEMPOOL_TRACE_EVENT(grow, *this);
+        }
+
+        void MemoryPoolHeadMT::get_batch(MemoryPoolItem **items, size_t item_count)
+        {
+            if (options_.debug.enabled)
+            {
+                // Every item must be checked
+                MemoryPoolHead::get_batch(items, item_count);
+                return;
+            }
+            take_items(items, item_count);
+            count_get(item_count);
+        }
+
+        void MemoryPoolHeadMT::add_batch(MemoryPoolItem *first, MemoryPoolItem *last, 
+            size_t item_count) noexcept
+        {
+            if (options_.debug.enabled)
+            {
+                MemoryPoolHead::add_batch(first, last, item_count);
+                return;
+            }
+            if (options_.wipe_on_release)
+            {
+                for (MemoryPoolItem *item = first; item != last; item = item->next())
+                {
+                    secure_zero(item->data(), item_byte_count_);
+                }
+                secure_zero(last->data(), item_byte_count_);
+            }
+            count_adds(item_count);
+#ifdef SEAL_MEMPOOL_TRACE
+            for (size_t i = 0; i < item_count; i++)
+            {
+                SEAL_MEMPOOL_TRACE_EVENT(add, *this);
+            }
+#endif
+            add_chain(first, last);
+        }
+
+        size_t MemoryPoolHeadMT::trim(size_t byte_count)
+        {
+            lock();
+
+            // Detach the free list so that items of allocations being released 
+            // cannot be handed out
+            tagged_item_ptr old_first = first_item_.load(memory_order_relaxed);
+            while (!first_item_.compare_exchange_weak(old_first, 
+                retag(nullptr, old_first), memory_order_acquire, memory_order_relaxed));
+            MemoryPoolItem *free_items = untag(old_first);
+
+            size_t released_byte_count = 0;
+            try
+            {
+                released_byte_count = release_free_allocations(allocs_, free_items, 
+                    byte_count, item_stride_, clear_on_destruction_, options_, 
+                    &retired_item_ptrs_);
+                item_count_.fetch_sub(released_byte_count / item_stride_, memory_order_relaxed);
+                count_page_bytes(allocs_, item_stride_, page_byte_counts_);
+            }
+            catch (...)
+            {
+                released_byte_count = 0;
+            }
+
+            // Return the remaining free items
+            if (free_items)
+            {
+                MemoryPoolItem *last_item = free_items;
+                while (last_item->next())
+                {
+                    last_item = last_item->next();
+                }
+                add_chain(free_items, last_item);
+            }
+
+            unlock();
+            return released_byte_count;
+        }
+
+        void MemoryPoolHeadMT::reserve(size_t item_count)
+        {
+            lock();
+
+            size_t old_item_count = item_count_.load(memory_order_relaxed);
+            if (old_item_count >= item_count)
+            {
+                unlock();
+                return;
+            }
+            size_t new_size = item_count - old_item_count;
+            try
+            {
+                if (mul_safe(new_size, item_stride_) > MemoryPool::max_batch_alloc_byte_count)
+                {
+                    throw invalid_argument("item_count too large");
+                }
+                allocs_.reserve(add_safe(allocs_.size(), size_t(1)));
+                MemoryPoolHead::allocation new_alloc = 
+                    new_allocation(new_size, item_stride_, options_);
+
+                // Only the last allocation is carved from, so the remaining 
+                // items of the current one go to the free list
+                if (!allocs_.empty())
+                {
+                    MemoryPoolItem *last_item;
+                    MemoryPoolItem *first_item = carve_remaining_items(
+                        allocs_.back(), item_stride_, last_item);
+                    if (first_item)
+                    {
+                        add_chain(first_item, last_item);
+                    }
+                }
+                allocs_.push_back(new_alloc);
+            }
+            catch (...)
+            {
+                unlock();
+                throw;
+            }
+            item_count_.fetch_add(new_size, memory_order_relaxed);
+            alloc_count_.fetch_add(1, memory_order_relaxed);
+            count_page_bytes(allocs_, item_stride_, page_byte_counts_);
+            SEAL_MEMPOOL_TRACE_EVENT(grow, *this);
+
+            unlock();
+        }
+
+        MemoryPoolStats MemoryPoolHeadMT::stats() const
+        {
+            MemoryPoolStats stats;
+            stats.get_count = get_count_.load(memory_order_relaxed);
+            stats.add_count = add_count_.load(memory_order_relaxed);
+            stats.outstanding_count = stats.get_count > stats.add_count ? 
+                stats.get_count - stats.add_count : 0;
+            stats.peak_outstanding_count = max(stats.outstanding_count, 
+                peak_outstanding_count_.load(memory_order_relaxed));
+            stats.growth_count = alloc_count_.load(memory_order_relaxed);
+            stats.spin_time = chrono::nanoseconds(spin_time_.load(memory_order_relaxed));
+            return stats;
+        }
+
+#ifndef _M_CEE
+        namespace
+        {
+            // The magazines of the calling thread, keyed by the head they belong to
+            class magazine_cache
+            {
+            public:
+                ~magazine_cache() noexcept
+                {
+                    for (auto &entry : magazines)
+                    {
+                        auto &mag = *entry.second;
+                        lock_guard<mutex> lock(mag.mutex);
+                        MemoryPoolHeadTC *owner = mag.owner.load(memory_order_acquire);
+                        if (owner)
+                        {
+                            owner->flush(mag);
+                        }
+                        mag.retired.store(true, memory_order_release);
+                    }
+                }
+
+                unordered_map<const MemoryPoolHeadTC*, 
+                    shared_ptr<MemoryPoolHeadTC::magazine>> magazines;
+
+                // Direct-mapped cache of recently used magazines in front of the map
+                static constexpr size_t recent_count = 16;
+
+                inline static size_t recent_index(const MemoryPoolHeadTC *head) noexcept
+                {
+                    return (reinterpret_cast<uintptr_t>(head) / 
+                        sizeof(MemoryPoolHeadTC)) % recent_count;
+                }
+
+                array<pair<const MemoryPoolHeadTC*, 
+                    MemoryPoolHeadTC::magazine*>, recent_count> recent{};
+            };
+
+            thread_local magazine_cache tls_magazines;
+        }
+
+        MemoryPoolHeadTC::MemoryPoolHeadTC(size_t item_byte_count,
+            size_t magazine_item_count, bool clear_on_destruction, 
+            const MemoryPoolOptions &options) :
+            MemoryPoolHeadMT(item_byte_count, clear_on_destruction, options),
+            magazine_item_count_(magazine_item_count)
+        {
+            if (magazine_item_count_ == 0)
+            {
+                throw invalid_argument("invalid magazine size");
+            }
+        }
+
+        MemoryPoolHeadTC::~MemoryPoolHeadTC() noexcept
+        {
+            // Detach the magazines; the cached items are released together 
+            // with the allocations
+            lock_guard<mutex> lock(magazines_mutex_);
+            for (auto &mag : magazines_)
+            {
+                lock_guard<mutex> mag_lock(mag->mutex);
+                mag->owner.store(nullptr, memory_order_release);
+                mag->first_item = nullptr;
+                mag->item_count = 0;
+            }
+            magazines_.clear();
+        }
+
+        MemoryPoolHeadTC::magazine *MemoryPoolHeadTC::local_magazine() noexcept
+        {
+            // In debug mode every item goes through the checks of the shared pool
+            if (options().debug.enabled)
+            {
+                return nullptr;
+            }
+
+            magazine_cache &cache = tls_magazines;
+            auto &recent = cache.recent[magazine_cache::recent_index(this)];
+            if (recent.first == this && 
+                recent.second->owner.load(memory_order_relaxed) == this)
+            {
+                return recent.second;
+            }
+
+            try
+            {
+                auto &entry = cache.magazines[this];
+
+                // A magazine without owner belongs to a destroyed head that 
+                // happened to live at the same address
+                if (!entry || entry->owner.load(memory_order_relaxed) != this)
+                {
+                    auto mag = make_shared<magazine>();
+                    mag->owner.store(this, memory_order_relaxed);
+                    mag->refill_items.resize(magazine_item_count_ / 2 + 1);
+                    {
+                        lock_guard<mutex> lock(magazines_mutex_);
+
+                        // Drop the magazines of threads that have exited
+                        magazines_.erase(remove_if(magazines_.begin(), magazines_.end(),
+                            [](const shared_ptr<magazine> &m) {
+                                return m->retired.load(memory_order_acquire);
+                            }), magazines_.end());
+                        magazines_.push_back(mag);
+                    }
+                    entry = move(mag);
+
+                    // Drop the magazines of destroyed heads
+                    cache.recent.fill({ nullptr, nullptr });
+                    for (auto it = cache.magazines.begin(); it != cache.magazines.end();)
+                    {
+                        if (!it->second->owner.load(memory_order_relaxed))
+                        {
+                            it = cache.magazines.erase(it);
+                        }
+                        else
+                        {
+                            ++it;
+                        }
+                    }
+                }
+
+                recent = { this, entry.get() };
+                return entry.get();
+            }
+            catch (...)
+            {
+                return nullptr;
+            }
+        }
+
+        MemoryPoolItem *MemoryPoolHeadTC::get()
+        {
+            magazine *mag = local_magazine();
+            if (!mag)
+            {
+                return MemoryPoolHeadMT::get();
+            }
+
+            if (mag->item_count == 0)
+            {
+                // Magazine is empty; take the item to hand out and half a magazine 
+                // in one refill: a chain of free items popped at once, and the 
+                // rest carved from the allocations under a single lock
+                MemoryPoolItem **items = mag->refill_items.data();
+                size_t refill_count = mag->refill_items.size();
+                take_items(items, refill_count);
+                for (size_t i = 1; i < refill_count; i++)
+                {
+                    items[i]->set_next(mag->first_item);
+                    mag->first_item = items[i];
+                }
+                mag->item_count = refill_count - 1;
+                mag->get_count.store(mag->get_count.load(memory_order_relaxed) + 1, 
+                    memory_order_relaxed);
+                SEAL_MEMPOOL_TRACE_EVENT(get, *this);
+                return items[0];
+            }
+
+            MemoryPoolItem *item = mag->first_item;
+            mag->first_item = item->next();
+            mag->item_count--;
+            item->set_next(nullptr);
+            mag->get_count.store(mag->get_count.load(memory_order_relaxed) + 1, 
+                memory_order_relaxed);
+            SEAL_MEMPOOL_TRACE_EVENT(get, *this);
+            return item;
+        }
+
+        void MemoryPoolHeadTC::add(MemoryPoolItem *new_first) noexcept
+        {
+            magazine *mag = local_magazine();
+            if (!mag)
+            {
+                MemoryPoolHeadMT::add(new_first);
+                return;
+            }
+            if (options().wipe_on_release)
+            {
+                secure_zero(new_first->data(), item_byte_count());
+            }
+
+            if (mag->item_count >= magazine_item_count_)
+            {
+                // Magazine is full; flush half of it to the shared pool
+                flush(*mag, max<size_t>(magazine_item_count_ / 2, 1));
+            }
+            new_first->set_next(mag->first_item);
+            mag->first_item = new_first;
+            mag->item_count++;
+            mag->add_count.store(mag->add_count.load(memory_order_relaxed) + 1, 
+                memory_order_relaxed);
+            SEAL_MEMPOOL_TRACE_EVENT(add, *this);
+        }
+
+        size_t MemoryPoolHeadTC::trim(size_t byte_count)
+        {
+            // Return the items cached by the calling thread first
+            magazine *mag = local_magazine();
+            if (mag)
+            {
+                flush(*mag);
+            }
+            return MemoryPoolHeadMT::trim(byte_count);
+        }
+
+        uint64_t MemoryPoolHeadTC::activity() const
+        {
+            uint64_t activity = MemoryPoolHeadMT::activity();
+            lock_guard<mutex> lock(magazines_mutex_);
+            for (auto &mag : magazines_)
+            {
+                activity += mag->get_count.load(memory_order_relaxed) + 
+                    mag->add_count.load(memory_order_relaxed);
+            }
+            return activity;
+        }
+
+        MemoryPoolStats MemoryPoolHeadTC::stats() const
+        {
+            MemoryPoolStats stats = MemoryPoolHeadMT::stats();
+            {
+                lock_guard<mutex> lock(magazines_mutex_);
+                for (auto &mag : magazines_)
+                {
+                    stats.get_count += mag->get_count.load(memory_order_relaxed);
+                    stats.add_count += mag->add_count.load(memory_order_relaxed);
+                }
+            }
+            stats.outstanding_count = stats.get_count > stats.add_count ? 
+                stats.get_count - stats.add_count : 0;
+            stats.peak_outstanding_count = max(
+                stats.peak_outstanding_count, stats.outstanding_count);
+            return stats;
+        }
+
+        void MemoryPoolHeadTC::flush(magazine &mag) noexcept
+        {
+            flush(mag, mag.item_count);
+
+            // Magazines of exited threads are dropped, so keep their counts here
+            count_gets(mag.get_count.exchange(0, memory_order_relaxed));
+            count_adds(mag.add_count.exchange(0, memory_order_relaxed));
+        }
+
+        void MemoryPoolHeadTC::flush(magazine &mag, size_t item_count) noexcept
+        {
+            if (item_count == 0)
+            {
+                return;
+            }
+            MemoryPoolItem *first = mag.first_item;
+            MemoryPoolItem *last = first;
+            for (size_t i = 1; i < item_count; i++)
+            {
+                last = last->next();
+            }
+            mag.first_item = last->next();
+            mag.item_count -= item_count;
+            add_chain(first, last);
+        }
+#endif
+        MemoryPoolHeadST::MemoryPoolHeadST(size_t item_byte_count,
+            bool clear_on_destruction, const MemoryPoolOptions &options) :
+            clear_on_destruction_(clear_on_destruction), options_(options),
+            item_byte_count_(item_byte_count), 
+            item_stride_(aligned_item_stride(item_byte_count, options.alignment)),
+            item_count_(MemoryPool::first_alloc_count), alloc_count_(1),
+            first_item_(nullptr)
+        {
+            if ((item_byte_count_ == 0) || 
+                (item_stride_ > MemoryPool::max_batch_alloc_byte_count) ||
+                (mul_safe(item_stride_, MemoryPool::first_alloc_count) > 
+                    MemoryPool::max_batch_alloc_byte_count))
+            {
+                throw invalid_argument("invalid allocation size");
+            }
+            validate_growth(options_.growth);
+
+            // Initial allocation
+            allocs_.clear();
+            allocs_.push_back(new_allocation(
+                first_allocation_size(item_stride_, options_.growth), 
+                item_stride_, options_));
+            item_count_ = allocs_.back().size;
+            count_page_bytes(allocs_, item_stride_, page_byte_counts_);
+        }
+
+        MemoryPoolHeadST::~MemoryPoolHeadST() noexcept
+        {
+            // The items live in the allocations so there is nothing to delete
+            first_item_ = nullptr;
+
+            // Delete the memory
+            for (auto &alloc : allocs_)
+            {
+                delete_allocation(alloc, item_stride_, clear_on_destruction_, options_);
+            }
+
+            allocs_.clear();
+        }
+
+        MemoryPoolItem *MemoryPoolHeadST::get()
+        {
+            MemoryPoolItem *item = get_item();
+            if (options_.debug.enabled)
+            {
+                reuse_item_data(item, item_byte_count_, item_stride_, options_);
+            }
+            return item;
+        }
+
+        void MemoryPoolHeadST::add_debug(MemoryPoolItem *new_first) noexcept
+        {
+            add_count_++;
+            SEAL_MEMPOOL_TRACE_EVENT(add, *this);
+            release_item_data(new_first, item_stride_, options_);
+
+            MemoryPoolItem *oldest = quarantine_.push(
+                new_first, options_.debug.quarantine_item_count);
+            if (oldest)
+            {
+                oldest->set_next(first_item_);
+                first_item_ = oldest;
+            }
+        }
+
+        void MemoryPoolHeadST::add_batch(MemoryPoolItem *first, MemoryPoolItem *last, 
+            size_t item_count) noexcept
+        {
+            if (options_.debug.enabled)
+            {
+                MemoryPoolHead::add_batch(first, last, item_count);
+                return;
+            }
+            if (options_.wipe_on_release)
+            {
+                for (MemoryPoolItem *item = first; item != last; item = item->next())
+                {
+                    secure_zero(item->data(), item_byte_count_);
+                }
+                secure_zero(last->data(), item_byte_count_);
+            }
+            add_count_ += item_count;
+#ifdef SEAL_MEMPOOL_TRACE
+            for (size_t i = 0; i < item_count; i++)
+            {
+                SEAL_MEMPOOL_TRACE_EVENT(add, *this);
+            }
+#endif
+            last->set_next(first_item_);
+            first_item_ = first;
+        }
+
+        MemoryPoolItem *MemoryPoolHeadST::get_item()
+        {
+            MemoryPoolItem *old_first = first_item_;
+
+            // Is pool empty?
+            if (old_first == nullptr)
+            {
+                MemoryPoolItem *new_item = nullptr;
+                if (!allocs_.empty() && allocs_.back().free > 0)
+                {
+                    // Pool is empty; there is memory
+                    new_item = carve_item(allocs_.back(), item_stride_);
+                }
+                else
+                {
+                    // Pool is empty; there is no memory (or all of it was trimmed)
+                    allocs_.push_back(new_allocation(allocs_.empty() ? 
+                        first_allocation_size(item_stride_, options_.growth) :
+                        next_allocation_size(allocs_.back().size, item_stride_, 
+                            options_.growth), 
+                        item_stride_, options_));
+                    item_count_ += allocs_.back().size;
+                    alloc_count_++;
+                    count_page_bytes(allocs_, item_stride_, page_byte_counts_);
+                    new_item = carve_item(allocs_.back(), item_stride_);
+                    SEAL_MEMPOOL_TRACE_EVENT(grow, *this);
+                }
+
+                count_get();
+                return new_item;
+            }
+
+            // Pool is not empty
+            first_item_ = old_first->next();
+            old_first->set_next(nullptr);
+            count_get();
+            return old_first;
+        }
+
+        size_t MemoryPoolHeadST::trim(size_t byte_count)
+        {
+            size_t released_byte_count = release_free_allocations(allocs_, first_item_, 
+                byte_count, item_stride_, clear_on_destruction_, options_, nullptr);
+            item_count_ -= released_byte_count / item_stride_;
+            count_page_bytes(allocs_, item_stride_, page_byte_counts_);
+            return released_byte_count;
+        }
+
+        void MemoryPoolHeadST::reserve(size_t item_count)
+        {
+            if (item_count_ >= item_count)
+            {
+                return;
+            }
+            size_t new_size = item_count - item_count_;
+            if (mul_safe(new_size, item_stride_) > MemoryPool::max_batch_alloc_byte_count)
+            {
+                throw invalid_argument("item_count too large");
+            }
+            allocs_.reserve(add_safe(allocs_.size(), size_t(1)));
+            allocation new_alloc = new_allocation(new_size, item_stride_, options_);
+
+            // Only the last allocation is carved from, so the remaining items of 
+            // the current one go to the free list
+            if (!allocs_.empty())
+            {
+                MemoryPoolItem *last_item;
+                MemoryPoolItem *first_item = carve_remaining_items(
+                    allocs_.back(), item_stride_, last_item);
+                if (first_item)
+                {
+                    last_item->set_next(first_item_);
+                    first_item_ = first_item;
+                }
+            }
+            allocs_.push_back(new_alloc);
+            item_count_ += new_size;
+            alloc_count_++;
+            count_page_bytes(allocs_, item_stride_, page_byte_counts_);
+            SEAL_MEMPOOL_TRACE_EVENT(grow, *this);
+        }
+
+        MemoryPoolStats MemoryPoolHeadST::stats() const
+        {
+            MemoryPoolStats stats;
+            stats.get_count = get_count_;
+            stats.add_count = add_count_;
+            stats.outstanding_count = get_count_ - add_count_;
+            stats.peak_outstanding_count = peak_outstanding_count_;
+            stats.growth_count = alloc_count_;
+            return stats;
+        }
+
+        const size_t MemoryPool::max_single_alloc_byte_count = 
+            []() -> size_t {
+                int bit_shift = static_cast<int>(
+                    ceil(log2(MemoryPool::alloc_size_multiplier)));
+                if (bit_shift < 0 || unsigned_geq(bit_shift, 
+                    sizeof(size_t) * static_cast<size_t>(bits_per_byte)))
+                {
+                    throw logic_error("alloc_size_multiplier too large");
+                }
+                return numeric_limits<size_t>::max() >> bit_shift;
+            }();
+
+        const size_t MemoryPool::max_batch_alloc_byte_count =
+            []() -> size_t {
+                int bit_shift = static_cast<int>(
+                    ceil(log2(MemoryPool::alloc_size_multiplier)));
+                if (bit_shift < 0 || unsigned_geq(bit_shift, 
+                    sizeof(size_t) * static_cast<size_t>(bits_per_byte)))
+                {
+                    throw logic_error("alloc_size_multiplier too large");
+                }
+                return numeric_limits<size_t>::max() >> bit_shift;
+            }();
+
+        SizeClassPolicy SizeClassPolicy::Table(vector<size_t> byte_counts)
+        {
+            if (byte_counts.empty() ||
+                find(byte_counts.cbegin(), byte_counts.cend(), size_t(0)) != byte_counts.cend())
+            {
+                throw invalid_argument("invalid size class table");
+            }
+            sort(byte_counts.begin(), byte_counts.end());
+            byte_counts.erase(unique(byte_counts.begin(), byte_counts.end()), byte_counts.end());
+            return SizeClassPolicy(policy_type::table, 0, move(byte_counts));
+        }
+
+        size_t SizeClassPolicy::round(size_t byte_count) const noexcept
+        {
+            switch (type_)
+            {
+            case policy_type::power_of_two:
+            {
+                int bit_count = get_significant_bit_count(
+                    static_cast<uint64_t>(byte_count - 1));
+                if (bit_count >= bits_per_uint64 || 
+                    (uint64_t(1) << bit_count) > MemoryPool::max_single_alloc_byte_count)
+                {
+                    return byte_count;
+                }
+                return static_cast<size_t>(uint64_t(1) << bit_count);
+            }
+
+            case policy_type::spaced:
+            {
+                // Classes between 2^(k-1) and 2^k are spaced by 2^(k-1-spacing_bits)
+                int bit_count = get_significant_bit_count(
+                    static_cast<uint64_t>(byte_count - 1));
+                int step_bits = max(bit_count - 1 - spacing_bits_, 0);
+                uint64_t step_mask = (uint64_t(1) << step_bits) - 1;
+                uint64_t rounded = (static_cast<uint64_t>(byte_count) + step_mask) & ~step_mask;
+                if (rounded < byte_count || rounded > MemoryPool::max_single_alloc_byte_count)
+                {
+                    return byte_count;
+                }
+                return static_cast<size_t>(rounded);
+            }
+
+            case policy_type::table:
+            {
+                auto it = lower_bound(byte_counts_.cbegin(), byte_counts_.cend(), byte_count);
+                return (it == byte_counts_.cend()) ? byte_count : *it;
+            }
+
+            default:
+                return byte_count;
+            }
+        }
+
+        const MemoryPoolOptions &MemoryPool::validate(const MemoryPoolOptions &options)
+        {
+            if (options.numa_node < -1 || options.numa_node >= 1024)
+            {
+                throw invalid_argument("invalid numa_node");
+            }
+            aligned_item_stride(1, options.alignment);
+            validate_growth(options.growth);
+            return options;
+        }
+
+        vector<Pointer<SEAL_BYTE>> MemoryPool::get_batch(
+            size_t byte_count, size_t item_count)
+        {
+            if (byte_count > max_single_alloc_byte_count)
+            {
+                throw invalid_argument("invalid allocation size");
+            }
+            vector<Pointer<SEAL_BYTE>> pointers;
+            if (byte_count == 0 || item_count == 0)
+            {
+                pointers.resize(item_count);
+                return pointers;
+            }
+
+            // Allocate everything that can fail before taking the items
+            pointers.reserve(item_count);
+            vector<MemoryPoolItem*> items(item_count);
+            MemoryPoolHead *head = get_head(round_byte_count(byte_count, item_count));
+            head->get_batch(items.data(), item_count);
+            for (MemoryPoolItem *item : items)
+            {
+                pointers.push_back(Pointer<SEAL_BYTE>(head, item));
+            }
+            return pointers;
+        }
+
+        void MemoryPool::release_batch(vector<Pointer<SEAL_BYTE>> &pointers) noexcept
+        {
+            MemoryPoolHead *head = nullptr;
+            MemoryPoolItem *first = nullptr;
+            MemoryPoolItem *last = nullptr;
+            size_t count = 0;
+            for (auto &pointer : pointers)
+            {
+                if (!pointer.head_)
+                {
+                    pointer.release();
+                    continue;
+                }
+                if (pointer.head_ != head)
+                {
+                    if (count)
+                    {
+                        head->add_batch(first, last, count);
+                    }
+                    head = pointer.head_;
+                    first = nullptr;
+                    count = 0;
+                }
+                if (first)
+                {
+                    last->set_next(pointer.item_);
+                }
+                else
+                {
+                    first = pointer.item_;
+                }
+                last = pointer.item_;
+                count++;
+
+                pointer.data_ = nullptr;
+                pointer.head_ = nullptr;
+                pointer.item_ = nullptr;
+                pointer.alias_ = false;
+            }
+            if (count)
+            {
+                head->add_batch(first, last, count);
+            }
+        }
+
+        MemoryPoolMT::~MemoryPoolMT() noexcept
+        {
+            WriterLock lock(pools_locker_.acquire_write());
+            heads_.store(nullptr, memory_order_relaxed);
+            for(MemoryPoolHead *head : pools_)
+            {
+                delete head;
+            }
+            pools_.clear();
+            head_tables_.clear();
+        }
+
+        Pointer<SEAL_BYTE> MemoryPoolMT::get_for_byte_count(size_t byte_count)
+        {
+            if (byte_count > max_single_alloc_byte_count)
+            {
+                throw invalid_argument("invalid allocation size");
+            }
+            else if (byte_count == 0)
+            {
+                return Pointer<SEAL_BYTE>();
+            }
+            return Pointer<SEAL_BYTE>(get_head(round_byte_count(byte_count)));
+        }
+
+        void MemoryPoolMT::reserve(size_t byte_count, size_t item_count)
+        {
+            if (byte_count > max_single_alloc_byte_count)
+            {
+                throw invalid_argument("invalid allocation size");
+            }
+            else if (byte_count == 0 || item_count == 0)
+            {
+                return;
+            }
+            get_head(size_classes_.round(byte_count))->reserve(item_count);
+        }
+
+        MemoryPoolHead *MemoryPoolMT::get_head(size_t byte_count)
+        {
+            // Attempt to find size.
+            MemoryPoolHead *head = find_head(byte_count);
+            if (head)
+            {
+                return head;
+            }
+
+            // Size was not found, so obtain an exclusive lock and search again.
+            WriterLock writer_lock(pools_locker_.acquire_write());
+            size_t start = 0;
+            size_t end = pools_.size();
+            while (start < end)
+            {
+                size_t mid = (start + end) / 2;
+                MemoryPoolHead *mid_head = pools_[mid];
+                size_t mid_byte_count = mid_head->item_byte_count();
+                if (byte_count < mid_byte_count)
+                {
+                    start = mid + 1;
+                }
+                else if (byte_count > mid_byte_count)
+                {
+                    end = mid;
+                }
+                else
+                {
+                    return mid_head;
+                }
+            }
+
+            // Size was still not found, but we own an exclusive lock so just add it,
+            // but first check if we are at maximum pool head count already.
+            if (pools_.size() >= max_pool_head_count)
+            {
+                throw runtime_error("maximum pool head count reached");
+            }
+
+            MemoryPoolHead *new_head = this->new_head(byte_count);
+            try
+            {
+                pools_.insert(pools_.begin() + static_cast<ptrdiff_t>(start), new_head);
+                publish_head(new_head);
+            }
+            catch (...)
+            {
+                pools_.erase(remove(pools_.begin(), pools_.end(), new_head), pools_.end());
+                delete new_head;
+                throw;
+            }
+
+            return new_head;
+        }
+
+        namespace
+        {
+            // Fibonacci hashing of a byte count to a table of 2^capacity_bits slots
+            inline size_t head_table_index(size_t byte_count, int capacity_bits) noexcept
+            {
+                return static_cast<size_t>((static_cast<uint64_t>(byte_count) * 
+                    0x9E3779B97F4A7C15ULL) >> (64 - capacity_bits));
+            }
+        }
+
+        MemoryPoolMT::head_table::head_table(int capacity_bits) :
+            capacity_bits(capacity_bits), 
+            slots(new atomic<MemoryPoolHead*>[size_t(1) << capacity_bits])
+        {
+            for (size_t i = 0; i < (size_t(1) << capacity_bits); i++)
+            {
+                slots[i].store(nullptr, memory_order_relaxed);
+            }
+        }
+
+        MemoryPoolHead *MemoryPoolMT::find_head(size_t byte_count) const noexcept
+        {
+            const head_table *table = heads_.load(memory_order_acquire);
+            if (!table)
+            {
+                return nullptr;
+            }
+            size_t mask = (size_t(1) << table->capacity_bits) - 1;
+            for (size_t index = head_table_index(byte_count, table->capacity_bits);; 
+                index = (index + 1) & mask)
+            {
+                MemoryPoolHead *head = table->slots[index].load(memory_order_acquire);
+                if (!head || head->item_byte_count() == byte_count)
+                {
+                    return head;
+                }
+            }
+        }
+
+        void MemoryPoolMT::publish_head(MemoryPoolHead *head)
+        {
+            auto insert = [](head_table &table, MemoryPoolHead *new_head) {
+                size_t mask = (size_t(1) << table.capacity_bits) - 1;
+                size_t index = head_table_index(
+                    new_head->item_byte_count(), table.capacity_bits);
+                while (table.slots[index].load(memory_order_relaxed))
+                {
+                    index = (index + 1) & mask;
+                }
+                table.slots[index].store(new_head, memory_order_release);
+                table.head_count++;
+            };
+
+            head_table *table = heads_.load(memory_order_relaxed);
+            if (!table || 
+                mul_safe(add_safe(table->head_count, size_t(1)), size_t(2)) > 
+                    (size_t(1) << table->capacity_bits))
+            {
+                // Publish a table twice as large holding all heads
+                auto new_table = make_unique<head_table>(
+                    table ? table->capacity_bits + 1 : 4);
+                table = new_table.get();
+                for (MemoryPoolHead *existing_head : pools_)
+                {
+                    if (existing_head != head)
+                    {
+                        insert(*table, existing_head);
+                    }
+                }
+                insert(*table, head);
+                head_tables_.push_back(move(new_table));
+                heads_.store(table, memory_order_release);
+            }
+            else
+            {
+                insert(*table, head);
+            }
+        }
+
+        MemoryPoolHeadMT *MemoryPoolMT::new_head(size_t byte_count)
+        {
+            return new MemoryPoolHeadMT(byte_count, clear_on_destruction_, options_);
+        }
+
+        size_t MemoryPoolMT::alloc_byte_count() const
+        {
+            ReaderLock lock(pools_locker_.acquire_read());
+
+            return accumulate(pools_.cbegin(), pools_.cend(), size_t(0), 
+                [](size_t byte_count, MemoryPoolHead *head) {
+                    return add_safe(byte_count, 
+                        mul_safe(head->item_count(), head->item_stride()));
+                });
+        }
+
+        vector<pair<size_t, size_t>> MemoryPoolMT::size_histogram() const
+        {
+            ReaderLock lock(pools_locker_.acquire_read());
+
+            vector<pair<size_t, size_t>> histogram;
+            histogram.reserve(pools_.size());
+            for (MemoryPoolHead *head : pools_)
+            {
+                histogram.emplace_back(head->item_byte_count(), head->item_count());
+            }
+            return histogram;
+        }
+
+        MemoryPoolStats MemoryPoolMT::stats() const
+        {
+            ReaderLock lock(pools_locker_.acquire_read());
+
+            MemoryPoolStats stats;
+            for (MemoryPoolHead *head : pools_)
+            {
+                MemoryPoolStats head_stats = head->stats();
+                stats.outstanding_count += head_stats.outstanding_count;
+                stats.peak_outstanding_count += head_stats.peak_outstanding_count;
+                stats.get_count += head_stats.get_count;
+                stats.add_count += head_stats.add_count;
+                stats.growth_count += head_stats.growth_count;
+                stats.spin_time += head_stats.spin_time;
+            }
+            return stats;
+        }
+
+        size_t MemoryPoolMT::alloc_count() const
+        {
+            ReaderLock lock(pools_locker_.acquire_read());
+
+            return accumulate(pools_.cbegin(), pools_.cend(), size_t(0), 
+                [](size_t count, MemoryPoolHead *head) {
+                    return add_safe(count, head->alloc_count());
+                });
+        }
+
+        size_t MemoryPoolMT::page_byte_count(page_type pages) const
+        {
+            ReaderLock lock(pools_locker_.acquire_read());
+
+            return accumulate(pools_.cbegin(), pools_.cend(), size_t(0), 
+                [pages](size_t byte_count, MemoryPoolHead *head) {
+                    return add_safe(byte_count, head->page_byte_count(pages));
+                });
+        }
+
+        size_t MemoryPoolMT::shrink_to(size_t byte_count)
+        {
+            ReaderLock lock(pools_locker_.acquire_read());
+
+            size_t current_byte_count = accumulate(pools_.cbegin(), pools_.cend(), size_t(0), 
+                [](size_t count, MemoryPoolHead *head) {
+                    return add_safe(count, 
+                        mul_safe(head->item_count(), head->item_stride()));
+                });
+            if (current_byte_count <= byte_count)
+            {
+                return 0;
+            }
+
+            // Trim the heads with the largest items first
+            size_t excess_byte_count = current_byte_count - byte_count;
+            size_t released_byte_count = 0;
+            for (MemoryPoolHead *head : pools_)
+            {
+                if (released_byte_count >= excess_byte_count)
+                {
+                    break;
+                }
+                released_byte_count += head->trim(excess_byte_count - released_byte_count);
+            }
+            return released_byte_count;
+        }
+#ifndef _M_CEE
+        size_t MemoryPoolMT::trim_idle(chrono::steady_clock::duration idle_time)
+        {
+            lock_guard<mutex> idle_lock(idle_mutex_);
+            auto now = chrono::steady_clock::now();
+
+            ReaderLock lock(pools_locker_.acquire_read());
+            size_t released_byte_count = 0;
+            for (MemoryPoolHead *head : pools_)
+            {
+                // All heads of this pool were created by new_head
+                auto mt_head = static_cast<MemoryPoolHeadMT*>(head);
+                auto activity = mt_head->activity();
+                auto state = idle_states_.find(head);
+                if (state == idle_states_.end())
+                {
+                    idle_states_.emplace(head, idle_state{ activity, now });
+                }
+                else if (state->second.activity != activity)
+                {
+                    state->second = idle_state{ activity, now };
+                }
+                else if (now - state->second.since >= idle_time)
+                {
+                    released_byte_count += head->trim(numeric_limits<size_t>::max());
+                    state->second = idle_state{ mt_head->activity(), now };
+                }
+            }
+            return released_byte_count;
+        }
+
+        MemoryPoolHeadMT *MemoryPoolTC::new_head(size_t byte_count)
+        {
+            return new MemoryPoolHeadTC(byte_count, magazine_item_count_, 
+                clear_on_destruction_, options_);
+        }
+#endif
+        MemoryPoolST::~MemoryPoolST() noexcept
+        {
+            for(MemoryPoolHead *head : pools_)
+            {
+                delete head;
+            }
+            pools_.clear();
+        }
+
+        Pointer<SEAL_BYTE> MemoryPoolST::get_for_byte_count(size_t byte_count)
+        {
+            if (byte_count > MemoryPool::max_single_alloc_byte_count)
+            {
+                throw invalid_argument("invalid allocation size");
+            }
+            else if (byte_count == 0)
+            {
+                return Pointer<SEAL_BYTE>();
+            }
+            return Pointer<SEAL_BYTE>(get_head(round_byte_count(byte_count)));
+        }
+
+        void MemoryPoolST::reserve(size_t byte_count, size_t item_count)
+        {
+            if (byte_count > MemoryPool::max_single_alloc_byte_count)
+            {
+                throw invalid_argument("invalid allocation size");
+            }
+            else if (byte_count == 0 || item_count == 0)
+            {
+                return;
+            }
+            get_head(size_classes_.round(byte_count))->reserve(item_count);
+        }
+
+        MemoryPoolHead *MemoryPoolST::get_head(size_t byte_count)
+        {
+            // Attempt to find size.
+            size_t start = 0;
+            size_t end = pools_.size();
+            while (start < end)
+            {
+                size_t mid = (start + end) / 2;
+                MemoryPoolHead *mid_head = pools_[mid];
+                size_t mid_byte_count = mid_head->item_byte_count();
+                if (byte_count < mid_byte_count)
+                {
+                    start = mid + 1;
+                }
+                else if (byte_count > mid_byte_count)
+                {
+                    end = mid;
+                }
+                else
+                {
+                    return mid_head;
+                }
+            }
+
+            // Size was not found so just add it, but first check if we are at 
+            // maximum pool head count already.
+            if (pools_.size() >= max_pool_head_count)
+            {
+                throw runtime_error("maximum pool head count reached");
+            }
+
+            MemoryPoolHead *new_head = new MemoryPoolHeadST(
+                byte_count, clear_on_destruction_, options_);
+            if (!pools_.empty())
+            {
+                pools_.insert(pools_.begin() + static_cast<ptrdiff_t>(start), new_head);
+            }
+            else
+            {
+                pools_.emplace_back(new_head);
+            }
+
+            return new_head;
+        }
+
+        size_t MemoryPoolST::alloc_byte_count() const
+        {
             return accumulate(pools_.cbegin(), pools_.cend(), size_t(0), 
                 [](size_t byte_count, MemoryPoolHead *head) {
                     return add_safe(byte_count, 
-                        mul_safe(head->item_count(), head->item_byte_count()));
+                        mul_safe(head->item_count(), head->item_stride()));
+                });
+        }
+
+        size_t MemoryPoolST::page_byte_count(page_type pages) const
+        {
+            return accumulate(pools_.cbegin(), pools_.cend(), size_t(0), 
+                [pages](size_t byte_count, MemoryPoolHead *head) {
+                    return add_safe(byte_count, head->page_byte_count(pages));
+                });
+        }
+
+        size_t MemoryPoolST::shrink_to(size_t byte_count)
+        {
+            size_t current_byte_count = alloc_byte_count();
+            if (current_byte_count <= byte_count)
+            {
+                return 0;
+            }
+
+            // Trim the heads with the largest items first
+            size_t excess_byte_count = current_byte_count - byte_count;
+            size_t released_byte_count = 0;
+            for (MemoryPoolHead *head : pools_)
+            {
+                if (released_byte_count >= excess_byte_count)
+                {
+                    break;
+                }
+                released_byte_count += head->trim(excess_byte_count - released_byte_count);
+            }
+            return released_byte_count;
+        }
+
+        vector<pair<size_t, size_t>> MemoryPoolST::size_histogram() const
+        {
+            vector<pair<size_t, size_t>> histogram;
+            histogram.reserve(pools_.size());
+            for (MemoryPoolHead *head : pools_)
+            {
+                histogram.emplace_back(head->item_byte_count(), head->item_count());
+            }
+            return histogram;
+        }
+
+        MemoryPoolStats MemoryPoolST::stats() const
+        {
+            MemoryPoolStats stats;
+            for (MemoryPoolHead *head : pools_)
+            {
+                MemoryPoolStats head_stats = head->stats();
+                stats.outstanding_count += head_stats.outstanding_count;
+                stats.peak_outstanding_count += head_stats.peak_outstanding_count;
+                stats.get_count += head_stats.get_count;
+                stats.add_count += head_stats.add_count;
+                stats.growth_count += head_stats.growth_count;
+                stats.spin_time += head_stats.spin_time;
+            }
+            return stats;
+        }
+
+        size_t MemoryPoolST::alloc_count() const
+        {
+            return accumulate(pools_.cbegin(), pools_.cend(), size_t(0), 
+                [](size_t count, MemoryPoolHead *head) {
+                    return add_safe(count, head->alloc_count());
                 });
         }
 
-        MemoryPoolST::~MemoryPoolST() noexcept
+        namespace
+        {
+            // Number of items of item_stride bytes that fit together with their 
+            // records between data and records
+            inline size_t arena_item_capacity(const SEAL_BYTE *data, 
+                const SEAL_BYTE *records, size_t item_stride) noexcept
+            {
+                return records > data ? static_cast<size_t>(records - data) / 
+                    (item_stride + sizeof(MemoryPoolItem)) : 0;
+            }
+        }
+
+        MemoryPoolHeadArena::MemoryPoolHeadArena(size_t item_byte_count, 
+            MemoryPoolArena &arena) :
+            arena_(arena), item_byte_count_(item_byte_count),
+            item_stride_(aligned_item_stride(item_byte_count, arena.alignment()))
+        {
+            if ((item_byte_count_ == 0) || 
+                (item_stride_ > MemoryPool::max_batch_alloc_byte_count))
+            {
+                throw invalid_argument("invalid allocation size");
+            }
+        }
+
+        size_t MemoryPoolHeadArena::alignment() const noexcept
+        {
+            return arena_.alignment();
+        }
+
+        size_t MemoryPoolHeadArena::item_count() const noexcept
+        {
+            return epoch_ == arena_.epoch_ ? item_count_ : 0;
+        }
+
+        MemoryPoolItem *MemoryPoolHeadArena::get()
+        {
+            MemoryPoolItem *item = arena_.carve(item_stride_);
+            ASAN_UNPOISON_MEMORY_REGION(item->data(), item_byte_count_);
+            if (epoch_ != arena_.epoch_)
+            {
+                // The arena was reset since the last item was handed out
+                item_count_ = 0;
+                epoch_ = arena_.epoch_;
+            }
+            item_count_++;
+            get_count_++;
+            arena_.outstanding_count_++;
+            peak_outstanding_count_ = max(peak_outstanding_count_, get_count_ - add_count_);
+            SEAL_MEMPOOL_TRACE_EVENT(get, *this);
+            return item;
+        }
+
+        void MemoryPoolHeadArena::add(MemoryPoolItem *new_first) noexcept
+        {
+            // The memory is reclaimed when the arena is reset
+            if (arena_.options_.debug.enabled)
+            {
+                release_item_data(new_first, item_stride_, arena_.options_);
+            }
+            else if (arena_.options_.wipe_on_release)
+            {
+                secure_zero(new_first->data(), item_byte_count_);
+            }
+            add_count_++;
+            arena_.outstanding_count_--;
+            SEAL_MEMPOOL_TRACE_EVENT(add, *this);
+        }
+
+        void MemoryPoolHeadArena::reserve(size_t item_count)
+        {
+            arena_.reserve_items(item_stride_, item_count);
+        }
+
+        MemoryPoolStats MemoryPoolHeadArena::stats() const
+        {
+            MemoryPoolStats stats;
+            stats.get_count = get_count_;
+            stats.add_count = add_count_;
+            stats.outstanding_count = get_count_ - add_count_;
+            stats.peak_outstanding_count = peak_outstanding_count_;
+            return stats;
+        }
+
+        MemoryPoolArena::MemoryPoolArena(size_t chunk_byte_count, 
+            bool clear_on_destruction, SizeClassPolicy size_classes, 
+            MemoryPoolOptions options) :
+            MemoryPool(move(size_classes)), chunk_byte_count_(chunk_byte_count),
+            clear_on_destruction_(clear_on_destruction), options_(validate(options))
+        {
+            if (chunk_byte_count_ == 0 || 
+                chunk_byte_count_ > MemoryPool::max_batch_alloc_byte_count)
+            {
+                throw invalid_argument("invalid chunk_byte_count");
+            }
+        }
+
+        MemoryPoolArena::~MemoryPoolArena() noexcept
+        {
+            for (MemoryPoolHead *head : pools_)
+            {
+                delete head;
+            }
+            pools_.clear();
+            for (auto &chunk : chunks_)
+            {
+                delete_chunk(chunk);
+            }
+            chunks_.clear();
+        }
+
+        MemoryPoolItem *MemoryPoolArena::carve(size_t item_stride)
+        {
+            // Move on to the first chunk with room, or add one
+            while (!arena_item_capacity(data_cursor_, record_cursor_, item_stride))
+            {
+                size_t next_chunk = data_cursor_ ? current_chunk_ + 1 : 0;
+                if (next_chunk >= chunks_.size())
+                {
+                    add_chunk(item_stride, 1);
+                }
+                start_chunk(next_chunk);
+            }
+
+            SEAL_BYTE *data = data_cursor_;
+            data_cursor_ += item_stride;
+            record_cursor_ -= sizeof(MemoryPoolItem);
+
+            // Debug mode may have poisoned the record as item data before a reset
+            ASAN_UNPOISON_MEMORY_REGION(record_cursor_, sizeof(MemoryPoolItem));
+            return new(record_cursor_) MemoryPoolItem(data);
+        }
+
+        void MemoryPoolArena::reserve_items(size_t item_stride, size_t item_count)
+        {
+            // Items do not span chunks, so count the room of each chunk separately
+            size_t capacity = arena_item_capacity(data_cursor_, record_cursor_, item_stride);
+            size_t first_unused_chunk = data_cursor_ ? current_chunk_ + 1 : 0;
+            for (size_t i = first_unused_chunk; i < chunks_.size() && capacity < item_count; i++)
+            {
+                capacity = add_safe(capacity, arena_item_capacity(
+                    chunks_[i].data_ptr, records_end(chunks_[i]), item_stride));
+            }
+            if (capacity < item_count)
+            {
+                add_chunk(item_stride, item_count - capacity);
+            }
+        }
+
+        void MemoryPoolArena::add_chunk(size_t item_stride, size_t item_count)
+        {
+            // Leave room for aligning the records
+            size_t byte_count = add_safe(mul_safe(
+                add_safe(item_stride, sizeof(MemoryPoolItem)), item_count), 
+                alignof(MemoryPoolItem));
+            if (byte_count > MemoryPool::max_batch_alloc_byte_count)
+            {
+                throw invalid_argument("item_count too large");
+            }
+
+            chunks_.reserve(add_safe(chunks_.size(), size_t(1)));
+            arena_chunk chunk;
+            chunk.byte_count = max(chunk_byte_count_, byte_count);
+            allocate_allocation_data(chunk, chunk.byte_count, options_);
+            chunks_.push_back(chunk);
+            alloc_count_++;
+        }
+
+        void MemoryPoolArena::start_chunk(size_t index) noexcept
+        {
+            current_chunk_ = index;
+            data_cursor_ = chunks_[index].data_ptr;
+            record_cursor_ = records_end(chunks_[index]);
+        }
+
+        void MemoryPoolArena::delete_chunk(arena_chunk &chunk) noexcept
+        {
+            // Released items are poisoned in debug mode
+            ASAN_UNPOISON_MEMORY_REGION(chunk.data_ptr, chunk.byte_count);
+            if (clear_on_destruction_)
+            {
+                secure_zero(chunk.data_ptr, chunk.byte_count);
+            }
+            free_allocation_data(chunk, chunk.byte_count, options_);
+        }
+
+        void MemoryPoolArena::reset()
         {
-            for(MemoryPoolHead *head : pools_)
+            if (outstanding_count_)
             {
-                delete head;
+                throw logic_error("allocations are outstanding");
             }
-            pools_.clear();
+
+            // Carving starts over at the first chunk, heads notice the new epoch 
+            // when they next hand out an item, and memory poisoned in debug mode 
+            // is unpoisoned as it is carved again
+            current_chunk_ = 0;
+            data_cursor_ = nullptr;
+            record_cursor_ = nullptr;
+            epoch_++;
         }
 
-        Pointer<SEAL_BYTE> MemoryPoolST::get_for_byte_count(size_t byte_count)
+        Pointer<SEAL_BYTE> MemoryPoolArena::get_for_byte_count(size_t byte_count)
         {
             if (byte_count > MemoryPool::max_single_alloc_byte_count)
             {
@@ -453,7 +2510,24 @@ namespace seal
             {
                 return Pointer<SEAL_BYTE>();
             }
+            return Pointer<SEAL_BYTE>(get_head(round_byte_count(byte_count)));
+        }
+
+        void MemoryPoolArena::reserve(size_t byte_count, size_t item_count)
+        {
+            if (byte_count > MemoryPool::max_single_alloc_byte_count)
+            {
+                throw invalid_argument("invalid allocation size");
+            }
+            else if (byte_count == 0 || item_count == 0)
+            {
+                return;
+            }
+            get_head(size_classes_.round(byte_count))->reserve(item_count);
+        }
 
+        MemoryPoolHead *MemoryPoolArena::get_head(size_t byte_count)
+        {
             // Attempt to find size.
             size_t start = 0;
             size_t end = pools_.size();
@@ -472,7 +2546,7 @@ namespace seal
                 }
                 else
                 {
-                    return Pointer<SEAL_BYTE>(mid_head);
+                    return mid_head;
                 }
             }
 
@@ -483,26 +2557,562 @@ namespace seal
                 throw runtime_error("maximum pool head count reached");
             }
 
-            MemoryPoolHead *new_head = new MemoryPoolHeadST(byte_count, clear_on_destruction_);
-            if (!pools_.empty())
+            auto new_head = make_unique<MemoryPoolHeadArena>(byte_count, *this);
+            pools_.insert(pools_.begin() + static_cast<ptrdiff_t>(start), new_head.get());
+            return new_head.release();
+        }
+
+        size_t MemoryPoolArena::alloc_byte_count() const
+        {
+            return accumulate(chunks_.cbegin(), chunks_.cend(), size_t(0), 
+                [](size_t byte_count, const arena_chunk &chunk) {
+                    return add_safe(byte_count, chunk.byte_count);
+                });
+        }
+
+        vector<pair<size_t, size_t>> MemoryPoolArena::size_histogram() const
+        {
+            vector<pair<size_t, size_t>> histogram;
+            histogram.reserve(pools_.size());
+            for (MemoryPoolHead *head : pools_)
             {
-                pools_.insert(pools_.begin() + static_cast<ptrdiff_t>(start), new_head);
+                histogram.emplace_back(head->item_byte_count(), head->item_count());
+            }
+            return histogram;
+        }
+
+        MemoryPoolStats MemoryPoolArena::stats() const
+        {
+            MemoryPoolStats stats;
+            for (MemoryPoolHead *head : pools_)
+            {
+                MemoryPoolStats head_stats = head->stats();
+                stats.outstanding_count += head_stats.outstanding_count;
+                stats.peak_outstanding_count += head_stats.peak_outstanding_count;
+                stats.get_count += head_stats.get_count;
+                stats.add_count += head_stats.add_count;
+            }
+            stats.growth_count = alloc_count_;
+            return stats;
+        }
+
+        size_t MemoryPoolArena::page_byte_count(page_type pages) const
+        {
+            size_t byte_count = 0;
+            for (auto &chunk : chunks_)
+            {
+                if (chunk.pages == pages)
+                {
+                    byte_count = add_safe(byte_count, chunk.byte_count);
+                }
+            }
+            return byte_count;
+        }
+
+        size_t MemoryPoolArena::shrink_to(size_t byte_count)
+        {
+            size_t current_byte_count = alloc_byte_count();
+            size_t released_byte_count = 0;
+
+            // Chunks after the current one are unused, as is the current one 
+            // if nothing was carved from it
+            while (!chunks_.empty() && current_byte_count - released_byte_count > byte_count)
+            {
+                size_t last = chunks_.size() - 1;
+                bool current = data_cursor_ && last == current_chunk_;
+                if (current && data_cursor_ != chunks_[last].data_ptr)
+                {
+                    break;
+                }
+                auto &chunk = chunks_.back();
+                released_byte_count += chunk.byte_count;
+                delete_chunk(chunk);
+                chunks_.pop_back();
+                if (current && chunks_.empty())
+                {
+                    current_chunk_ = 0;
+                    data_cursor_ = nullptr;
+                    record_cursor_ = nullptr;
+                }
+                else if (current)
+                {
+                    // The chunk before is used, so leave it without room
+                    current_chunk_--;
+                    data_cursor_ = records_end(chunks_[current_chunk_]);
+                    record_cursor_ = data_cursor_;
+                }
+            }
+            return released_byte_count;
+        }
+
+        namespace
+        {
+            // Layout of the start of a MemoryPoolShared segment; offsets are 
+            // relative to the start of the segment, and zero ends a free list
+            struct shared_segment_header
+            {
+                static constexpr std::uint64_t magic_value = 0x314D485341455300ULL;
+
+                static constexpr std::size_t class_count = 64;
+
+                // Set last by the creating process once the header is valid
+                atomic<std::uint64_t> magic;
+
+                std::uint64_t byte_count;
+
+                atomic<std::uint32_t> locked;
+
+                // Start of the memory not yet carved into items
+                atomic<std::uint64_t> carved_offset;
+
+                std::uint64_t free_offsets[class_count];
+
+                atomic<std::uint64_t> item_counts[class_count];
+            };
+
+            static_assert(atomic<std::uint64_t>::is_always_lock_free &&
+                atomic<std::uint32_t>::is_always_lock_free,
+                "shared memory pools need address-free atomics");
+
+            constexpr std::size_t shared_data_offset = 
+                (sizeof(shared_segment_header) + default_pool_alignment - 1) & 
+                ~(default_pool_alignment - 1);
+
+            // Exponent of the smallest power of two of at least byte_count bytes 
+            // and default_pool_alignment
+            inline size_t shared_class_index(size_t byte_count)
+            {
+                size_t class_index = static_cast<size_t>(
+                    get_significant_bit_count(byte_count - 1));
+                return max(class_index, static_cast<size_t>(
+                    get_significant_bit_count(default_pool_alignment - 1)));
+            }
+
+            inline shared_segment_header &shared_header(SEAL_BYTE *segment) noexcept
+            {
+                return *reinterpret_cast<shared_segment_header*>(segment);
+            }
+
+            inline std::uint64_t &shared_next(SEAL_BYTE *data) noexcept
+            {
+                return *reinterpret_cast<std::uint64_t*>(data);
+            }
+        }
+
+        MemoryPoolHeadShared::~MemoryPoolHeadShared() noexcept
+        {
+            while (spare_items_)
+            {
+                MemoryPoolItem *item = spare_items_;
+                spare_items_ = item->next();
+                delete item;
+            }
+        }
+
+        size_t MemoryPoolHeadShared::alignment() const noexcept
+        {
+            return default_pool_alignment;
+        }
+
+        size_t MemoryPoolHeadShared::item_count() const noexcept
+        {
+            return static_cast<size_t>(shared_header(pool_.segment_).
+                item_counts[class_index_].load(memory_order_relaxed));
+        }
+
+        MemoryPoolItem *MemoryPoolHeadShared::new_item(SEAL_BYTE *data)
+        {
+            MemoryPoolItem *item = nullptr;
+            while (records_locked_.exchange(true, memory_order_acquire));
+            if (spare_items_)
+            {
+                item = spare_items_;
+                spare_items_ = item->next();
+            }
+            records_locked_.store(false, memory_order_release);
+
+            // Item records are trivially destructible
+            item = item ? new (item) MemoryPoolItem(data) : new MemoryPoolItem(data);
+            size_t outstanding = outstanding_count_.fetch_add(1, memory_order_relaxed) + 1;
+            size_t peak = peak_outstanding_count_.load(memory_order_relaxed);
+            while (outstanding > peak && !peak_outstanding_count_.compare_exchange_weak(
+                peak, outstanding, memory_order_relaxed));
+            return item;
+        }
+
+        void MemoryPoolHeadShared::delete_item(MemoryPoolItem *item) noexcept
+        {
+            outstanding_count_.fetch_sub(1, memory_order_relaxed);
+            while (records_locked_.exchange(true, memory_order_acquire));
+            item->set_next(spare_items_);
+            spare_items_ = item;
+            records_locked_.store(false, memory_order_release);
+        }
+
+        MemoryPoolItem *MemoryPoolHeadShared::get()
+        {
+            SEAL_BYTE *data = pool_.pop(class_index_);
+            MemoryPoolItem *item;
+            try
+            {
+                item = new_item(data);
+            }
+            catch (const bad_alloc &)
+            {
+                // Allocation failed; return data and rethrow
+                pool_.push(class_index_, data, data);
+                throw;
+            }
+            get_count_.fetch_add(1, memory_order_relaxed);
+            SEAL_MEMPOOL_TRACE_EVENT(get, *this);
+            return item;
+        }
+
+        void MemoryPoolHeadShared::add(MemoryPoolItem *new_first) noexcept
+        {
+            SEAL_BYTE *data = new_first->data();
+            delete_item(new_first);
+            pool_.push(class_index_, data, data);
+            add_count_.fetch_add(1, memory_order_relaxed);
+            SEAL_MEMPOOL_TRACE_EVENT(add, *this);
+        }
+
+        void MemoryPoolHeadShared::reserve(size_t item_count)
+        {
+            size_t current_item_count = this->item_count();
+            if (item_count <= current_item_count)
+            {
+                return;
+            }
+
+            // Carve the missing items and put them on the free list at once
+            size_t new_item_count = item_count - current_item_count;
+            auto &header = shared_header(pool_.segment_);
+            pool_.lock();
+            std::uint64_t offset = header.carved_offset.load(memory_order_relaxed);
+            if (mul_safe(new_item_count, item_byte_count_) > header.byte_count - offset)
+            {
+                pool_.unlock();
+                throw bad_alloc();
+            }
+            for (size_t i = 0; i < new_item_count; i++)
+            {
+                shared_next(pool_.segment_ + offset) = (i + 1 < new_item_count) ? 
+                    offset + item_byte_count_ : header.free_offsets[class_index_];
+                offset += item_byte_count_;
+            }
+            header.free_offsets[class_index_] = 
+                header.carved_offset.load(memory_order_relaxed);
+            header.carved_offset.store(offset, memory_order_relaxed);
+            header.item_counts[class_index_].fetch_add(
+                new_item_count, memory_order_relaxed);
+            pool_.unlock();
+        }
+
+        MemoryPoolStats MemoryPoolHeadShared::stats() const
+        {
+            MemoryPoolStats stats;
+            stats.get_count = get_count_.load(memory_order_relaxed);
+            stats.add_count = add_count_.load(memory_order_relaxed);
+            stats.outstanding_count = outstanding_count_.load(memory_order_relaxed);
+            stats.peak_outstanding_count = 
+                peak_outstanding_count_.load(memory_order_relaxed);
+            return stats;
+        }
+
+        MemoryPoolShared::MemoryPoolShared(const string &name, size_t byte_count) : 
+            name_(name)
+        {
+#if defined(__linux__)
+            if (name_.empty())
+            {
+                throw invalid_argument("name");
+            }
+            bool created = true;
+            int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (fd < 0 && errno == EEXIST)
+            {
+                created = false;
+                fd = shm_open(name_.c_str(), O_RDWR, 0);
+            }
+            if (fd < 0)
+            {
+                throw runtime_error("cannot open shared memory segment");
+            }
+
+            size_t map_byte_count = byte_count;
+            if (created)
+            {
+                if (byte_count < shared_data_offset + default_pool_alignment || 
+                    ftruncate(fd, static_cast<off_t>(byte_count)))
+                {
+                    close(fd);
+                    shm_unlink(name_.c_str());
+                    throw invalid_argument("invalid byte_count");
+                }
             }
             else
             {
-                pools_.emplace_back(new_head);
+                // The creating process may not have sized the segment yet
+                struct stat st;
+                for (int tries = 0; !fstat(fd, &st) && 
+                    static_cast<size_t>(st.st_size) < sizeof(shared_segment_header) && 
+                    tries < 1000; tries++)
+                {
+                    this_thread::sleep_for(chrono::milliseconds(1));
+                }
+                map_byte_count = static_cast<size_t>(st.st_size);
+                if (map_byte_count < sizeof(shared_segment_header))
+                {
+                    close(fd);
+                    throw runtime_error("shared memory segment is not initialized");
+                }
+            }
+            void *ptr = mmap(nullptr, map_byte_count, PROT_READ | PROT_WRITE, 
+                MAP_SHARED, fd, 0);
+            close(fd);
+            if (ptr == MAP_FAILED)
+            {
+                if (created)
+                {
+                    shm_unlink(name_.c_str());
+                }
+                throw bad_alloc();
             }
+            segment_ = static_cast<SEAL_BYTE*>(ptr);
+            segment_byte_count_ = map_byte_count;
 
-            return Pointer<SEAL_BYTE>(new_head);
+            auto &header = shared_header(segment_);
+            if (created)
+            {
+                // A new segment is zero-filled, so the free lists are empty
+                header.byte_count = byte_count;
+                header.locked.store(0, memory_order_relaxed);
+                header.carved_offset.store(shared_data_offset, memory_order_relaxed);
+                header.magic.store(shared_segment_header::magic_value, 
+                    memory_order_release);
+            }
+            else
+            {
+                for (int tries = 0; header.magic.load(memory_order_acquire) != 
+                    shared_segment_header::magic_value && tries < 1000; tries++)
+                {
+                    this_thread::sleep_for(chrono::milliseconds(1));
+                }
+                if (header.magic.load(memory_order_acquire) != 
+                    shared_segment_header::magic_value || 
+                    header.byte_count != segment_byte_count_)
+                {
+                    munmap(segment_, segment_byte_count_);
+                    throw runtime_error("shared memory segment is not initialized");
+                }
+            }
+
+            // One head for every power of two that fits in the segment
+            size_t last_class_index = static_cast<size_t>(
+                get_significant_bit_count(segment_byte_count_ - shared_data_offset)) - 1;
+            pools_.resize(last_class_index + 1);
+            for (size_t class_index = shared_class_index(1); 
+                class_index <= last_class_index; class_index++)
+            {
+                pools_[class_index].reset(new MemoryPoolHeadShared(
+                    size_t(1) << class_index, class_index, *this));
+            }
+#else
+            (void)byte_count;
+            throw logic_error("shared memory pools are only supported on Linux");
+#endif
         }
 
-        size_t MemoryPoolST::alloc_byte_count() const
+        MemoryPoolShared::~MemoryPoolShared() noexcept
         {
-            return accumulate(pools_.cbegin(), pools_.cend(), size_t(0), 
-                [](size_t byte_count, MemoryPoolHead *head) {
-                    return add_safe(byte_count, 
-                        mul_safe(head->item_count(), head->item_byte_count()));
-                });
+            pools_.clear();
+#if defined(__linux__)
+            if (segment_)
+            {
+                munmap(segment_, segment_byte_count_);
+            }
+#endif
+        }
+
+        bool MemoryPoolShared::remove(const string &name) noexcept
+        {
+#if defined(__linux__)
+            return !shm_unlink(name.c_str());
+#else
+            (void)name;
+            return false;
+#endif
+        }
+
+        Pointer<SEAL_BYTE> MemoryPoolShared::get_for_byte_count(size_t byte_count)
+        {
+            if (byte_count > MemoryPool::max_single_alloc_byte_count)
+            {
+                throw invalid_argument("invalid allocation size");
+            }
+            else if (byte_count == 0)
+            {
+                return Pointer<SEAL_BYTE>();
+            }
+            return Pointer<SEAL_BYTE>(get_head(byte_count));
+        }
+
+        void MemoryPoolShared::reserve(size_t byte_count, size_t item_count)
+        {
+            if (byte_count > MemoryPool::max_single_alloc_byte_count)
+            {
+                throw invalid_argument("invalid allocation size");
+            }
+            else if (byte_count == 0 || item_count == 0)
+            {
+                return;
+            }
+            get_head(byte_count)->reserve(item_count);
+        }
+
+        MemoryPoolHead *MemoryPoolShared::get_head(size_t byte_count)
+        {
+            size_t class_index = shared_class_index(byte_count);
+            if (class_index >= pools_.size())
+            {
+                throw bad_alloc();
+            }
+            return pools_[class_index].get();
+        }
+
+        size_t MemoryPoolShared::pool_count() const
+        {
+            return static_cast<size_t>(count_if(pools_.begin(), pools_.end(), 
+                [](auto &head) { return head && head->item_count(); }));
+        }
+
+        size_t MemoryPoolShared::alloc_byte_count() const
+        {
+            return static_cast<size_t>(shared_header(segment_).carved_offset.load(
+                memory_order_relaxed)) - shared_data_offset;
+        }
+
+        vector<pair<size_t, size_t>> MemoryPoolShared::size_histogram() const
+        {
+            vector<pair<size_t, size_t>> histogram;
+            for (auto it = pools_.rbegin(); it != pools_.rend(); ++it)
+            {
+                if (*it && (*it)->item_count())
+                {
+                    histogram.emplace_back((*it)->item_byte_count(), (*it)->item_count());
+                }
+            }
+            return histogram;
+        }
+
+        MemoryPoolStats MemoryPoolShared::stats() const
+        {
+            MemoryPoolStats stats;
+            for (auto &head : pools_)
+            {
+                if (head)
+                {
+                    MemoryPoolStats head_stats = head->stats();
+                    stats.outstanding_count += head_stats.outstanding_count;
+                    stats.peak_outstanding_count += head_stats.peak_outstanding_count;
+                    stats.get_count += head_stats.get_count;
+                    stats.add_count += head_stats.add_count;
+                }
+            }
+            return stats;
+        }
+
+        size_t MemoryPoolShared::page_byte_count(page_type pages) const
+        {
+            return pages == page_type::standard ? alloc_byte_count() : 0;
+        }
+
+        size_t MemoryPoolShared::offset_of(const void *data) const
+        {
+            auto ptr = static_cast<const SEAL_BYTE*>(data);
+            if (ptr < segment_ + shared_data_offset || 
+                ptr >= segment_ + segment_byte_count_)
+            {
+                throw invalid_argument("data is not in the segment");
+            }
+            return static_cast<size_t>(ptr - segment_);
+        }
+
+        SEAL_BYTE *MemoryPoolShared::data_at(size_t offset) const
+        {
+            if (offset < shared_data_offset || offset >= segment_byte_count_)
+            {
+                throw out_of_range("offset");
+            }
+            return segment_ + offset;
+        }
+
+        Pointer<SEAL_BYTE> MemoryPoolShared::adopt(size_t offset, size_t byte_count)
+        {
+            if (byte_count == 0 || byte_count > MemoryPool::max_single_alloc_byte_count)
+            {
+                throw invalid_argument("invalid allocation size");
+            }
+            auto head = static_cast<MemoryPoolHeadShared*>(get_head(byte_count));
+            if (offset < shared_data_offset || (offset & (default_pool_alignment - 1)) ||
+                head->item_byte_count() > segment_byte_count_ - offset)
+            {
+                throw out_of_range("offset");
+            }
+            return Pointer<SEAL_BYTE>(head, head->new_item(segment_ + offset));
+        }
+
+        SEAL_BYTE *MemoryPoolShared::pop(size_t class_index)
+        {
+            auto &header = shared_header(segment_);
+            lock();
+            std::uint64_t offset = header.free_offsets[class_index];
+            if (offset)
+            {
+                header.free_offsets[class_index] = shared_next(segment_ + offset);
+            }
+            else
+            {
+                offset = header.carved_offset.load(memory_order_relaxed);
+                std::uint64_t item_byte_count = std::uint64_t(1) << class_index;
+                if (item_byte_count > header.byte_count - offset)
+                {
+                    unlock();
+                    throw bad_alloc();
+                }
+                header.carved_offset.store(offset + item_byte_count, memory_order_relaxed);
+                header.item_counts[class_index].fetch_add(1, memory_order_relaxed);
+            }
+            unlock();
+            return segment_ + offset;
+        }
+
+        void MemoryPoolShared::push(size_t class_index, 
+            SEAL_BYTE *first, SEAL_BYTE *last) noexcept
+        {
+            auto &header = shared_header(segment_);
+            lock();
+            shared_next(last) = header.free_offsets[class_index];
+            header.free_offsets[class_index] = static_cast<std::uint64_t>(first - segment_);
+            unlock();
+        }
+
+        void MemoryPoolShared::lock() const noexcept
+        {
+            auto &locked = shared_header(segment_).locked;
+            while (locked.exchange(1, memory_order_acquire))
+            {
+                while (locked.load(memory_order_relaxed))
+                {
+                    this_thread::yield();
+                }
+            }
+        }
+
+        void MemoryPoolShared::unlock() const noexcept
+        {
+            shared_header(segment_).locked.store(0, memory_order_release);
         }
     }
 }
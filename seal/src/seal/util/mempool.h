@@ -6,6 +6,7 @@
 #include <cstdint>
 #include <cstring>
 #include <vector>
+#include <utility>
 #include <stdexcept>
 #include <memory>
 #include <limits>
@@ -13,6 +14,13 @@
 #include <type_traits>
 #include <new>
 #include <algorithm>
+#include <chrono>
+#include <unordered_map>
+#include <map>
+#include <string>
+#ifndef _M_CEE
+#include <mutex>
+#endif
 #include "seal/util/defines.h"
 #include "seal/util/globals.h"
 #include "seal/util/common.h"
@@ -33,6 +41,363 @@ namespace seal
             typename = std::enable_if_t<std::is_standard_layout<T>::value>>
         class Pointer;
 
+        // Kind of memory pages backing the allocations of a memory pool
+        enum class page_type : int
+        {
+            // Memory from operator new[]
+            standard = 0,
+
+            // Anonymous mapping with a transparent huge page hint
+            transparent_huge = 1,
+
+            // Anonymous mapping from the huge page pool (MAP_HUGETLB)
+            huge = 2
+        };
+
+        constexpr int page_type_count = 3;
+
+        // Default alignment of pool allocations; matches the cache line size 
+        // and the widest vector registers of current x86-64 processors
+        constexpr std::size_t default_pool_alignment = 64;
+
+        // Largest supported alignment of pool allocations (the smallest page size)
+        constexpr std::size_t max_pool_alignment = 4096;
+
+        /*
+        Policy for sizing the allocations (slabs) that a memory pool head obtains 
+        from the system allocator. The first slab holds enough items to fill 
+        min_slab_byte_count bytes (at least one), every following slab holds 
+        growth_factor times as many items as the one before, and no slab exceeds 
+        max_slab_byte_count bytes unless a single item does.
+        */
+        struct SlabGrowthPolicy
+        {
+            // Must be at least 1; the default matches MemoryPool::alloc_size_multiplier
+            double growth_factor = 1.05;
+
+            std::size_t min_slab_byte_count = 0;
+
+            std::size_t max_slab_byte_count = std::numeric_limits<std::size_t>::max();
+        };
+
+        // What a thread does once it has spun for the lock of a thread-safe 
+        // memory pool head without getting it
+        enum class lock_wait_type : int
+        {
+            // Keep spinning
+            spin = 0,
+
+            // Yield the processor between attempts
+            yield = 1,
+
+            // Sleep until the lock is released; uses a futex on Linux and 
+            // falls back to yield elsewhere
+            park = 2
+        };
+
+        /*
+        How threads wait for the lock of a thread-safe memory pool head, which 
+        is only taken to grow, trim or reserve. A waiter first spins for 
+        spin_round_count rounds, round i executing 2^i pause instructions, 
+        and then waits as given by wait. Spinning alone is fastest with at most 
+        one thread per core, but collapses when threads outnumber cores.
+        */
+        struct LockWaitPolicy
+        {
+            lock_wait_type wait = lock_wait_type::park;
+
+            // At most max_spin_round_count
+            std::uint32_t spin_round_count = 8;
+
+            static constexpr std::uint32_t max_spin_round_count = 16;
+        };
+
+        /*
+        Checks for finding use-after-release bugs, at the cost of speed and 
+        memory. Released items are overwritten with poison_byte and checked for 
+        modifications before they are handed out again; a modified item makes 
+        get throw std::logic_error. Released items are held in a FIFO quarantine 
+        before reuse, so that a stale pointer does not immediately alias a new 
+        allocation. In builds with AddressSanitizer free items are also marked 
+        as inaccessible, so that stale accesses are reported where they happen. 
+        Thread-caching pools bypass their per-thread caches in debug mode, and 
+        arena pools only poison released items, as they never reuse items 
+        before a reset.
+        */
+        struct MemoryPoolDebugOptions
+        {
+            static constexpr unsigned char poison_byte = 0xDB;
+
+            // Enables debug mode; the other settings have no effect without it
+            bool enabled = false;
+
+            bool poison = true;
+
+            // Number of released items each pool head holds back from reuse
+            std::size_t quarantine_item_count = 1024;
+
+            // Places an inaccessible page right after the data of every 
+            // allocation; forces standard pages and is only supported on Linux
+            bool guard_pages = false;
+        };
+
+        /*
+        Limit on the number of bytes that the memory pools sharing it obtain from 
+        the system allocator. An allocation that would exceed the limit fails 
+        with std::bad_alloc, so a pool that reaches its quota stops growing 
+        instead of taking memory from everyone else. Memory is counted as 
+        requested, not including any rounding to pages.
+        */
+        class MemoryPoolQuota
+        {
+        public:
+            MemoryPoolQuota(std::size_t byte_limit = 
+                std::numeric_limits<std::size_t>::max()) noexcept : 
+                byte_limit_(byte_limit)
+            {
+            }
+
+            // Charges byte_count bytes if that does not exceed the limit; 
+            // otherwise counts a rejection and returns false
+            bool try_charge(std::size_t byte_count) noexcept;
+
+            inline void refund(std::size_t byte_count) noexcept
+            {
+                byte_count_.fetch_sub(byte_count, std::memory_order_relaxed);
+            }
+
+            inline std::size_t byte_limit() const noexcept
+            {
+                return byte_limit_.load(std::memory_order_relaxed);
+            }
+
+            // Lowering the limit does not release memory already charged
+            inline void set_byte_limit(std::size_t byte_limit) noexcept
+            {
+                byte_limit_.store(byte_limit, std::memory_order_relaxed);
+            }
+
+            // Bytes currently charged
+            inline std::size_t byte_count() const noexcept
+            {
+                return byte_count_.load(std::memory_order_relaxed);
+            }
+
+            inline std::size_t peak_byte_count() const noexcept
+            {
+                return peak_byte_count_.load(std::memory_order_relaxed);
+            }
+
+            // Number of allocations that failed because of the limit
+            inline std::size_t rejected_count() const noexcept
+            {
+                return rejected_count_.load(std::memory_order_relaxed);
+            }
+
+        private:
+            MemoryPoolQuota(const MemoryPoolQuota &copy) = delete;
+
+            MemoryPoolQuota &operator =(const MemoryPoolQuota &assign) = delete;
+
+            std::atomic<std::size_t> byte_limit_;
+
+            std::atomic<std::size_t> byte_count_{ 0 };
+
+            std::atomic<std::size_t> peak_byte_count_{ 0 };
+
+            std::atomic<std::size_t> rejected_count_{ 0 };
+        };
+
+        /*
+        Source of the large blocks of memory (slabs) that memory pools carve into 
+        items. A pool with a slab provider obtains all its slabs from it instead 
+        of from operator new[] or its own mappings. Providers must be thread-safe 
+        if shared by several pools or used by a thread-safe pool.
+        */
+        class MemoryPoolSlabProvider
+        {
+        public:
+            virtual ~MemoryPoolSlabProvider() = default;
+
+            // Returns byte_count bytes aligned to alignment, a power of two no 
+            // larger than max_pool_alignment, and sets pages to the kind of 
+            // pages backing them; throws std::bad_alloc on failure
+            virtual SEAL_BYTE *allocate(std::size_t byte_count, 
+                std::size_t alignment, page_type &pages) = 0;
+
+            // Returns a slab obtained from allocate with the same byte_count 
+            // and alignment
+            virtual void deallocate(SEAL_BYTE *data, std::size_t byte_count, 
+                std::size_t alignment) noexcept = 0;
+        };
+
+        // Obtains slabs from the aligned operator new[]
+        class MemoryPoolSlabProviderNew : public MemoryPoolSlabProvider
+        {
+        public:
+            SEAL_BYTE *allocate(std::size_t byte_count, std::size_t alignment, 
+                page_type &pages) override;
+
+            void deallocate(SEAL_BYTE *data, std::size_t byte_count, 
+                std::size_t alignment) noexcept override;
+        };
+
+        /*
+        Obtains slabs as anonymous mappings backed by the requested kind of pages, 
+        optionally preferring a NUMA node, with the same fallbacks as 
+        MemoryPoolOptions::pages. Falls back to operator new[] on platforms 
+        other than Linux.
+        */
+        class MemoryPoolSlabProviderMmap : public MemoryPoolSlabProvider
+        {
+        public:
+            MemoryPoolSlabProviderMmap(page_type pages = page_type::standard, 
+                int numa_node = -1) noexcept : pages_(pages), numa_node_(numa_node)
+            {
+            }
+
+            SEAL_BYTE *allocate(std::size_t byte_count, std::size_t alignment, 
+                page_type &pages) override;
+
+            void deallocate(SEAL_BYTE *data, std::size_t byte_count, 
+                std::size_t alignment) noexcept override;
+
+        private:
+            const page_type pages_;
+
+            const int numa_node_;
+        };
+
+        // Obtains slabs of at least huge_page_byte_count bytes from huge pages
+        class MemoryPoolSlabProviderHugePages : public MemoryPoolSlabProviderMmap
+        {
+        public:
+            MemoryPoolSlabProviderHugePages(int numa_node = -1) noexcept : 
+                MemoryPoolSlabProviderMmap(page_type::huge, numa_node)
+            {
+            }
+        };
+
+        /*
+        Carves slabs out of a fixed region of memory supplied by the caller, 
+        such as a shared memory segment or a region locked with mlock. The 
+        region is not owned and must outlive the provider and every pool using 
+        it. Freed slabs are merged with adjacent free space; an allocation that 
+        does not fit fails with std::bad_alloc.
+        */
+        class MemoryPoolSlabProviderRegion : public MemoryPoolSlabProvider
+        {
+        public:
+            MemoryPoolSlabProviderRegion(void *data, std::size_t byte_count, 
+                page_type pages = page_type::standard);
+
+            SEAL_BYTE *allocate(std::size_t byte_count, std::size_t alignment, 
+                page_type &pages) override;
+
+            void deallocate(SEAL_BYTE *data, std::size_t byte_count, 
+                std::size_t alignment) noexcept override;
+
+            // Bytes not currently handed out, possibly fragmented
+            std::size_t free_byte_count() const;
+
+        private:
+            MemoryPoolSlabProviderRegion(
+                const MemoryPoolSlabProviderRegion &copy) = delete;
+
+            MemoryPoolSlabProviderRegion &operator =(
+                const MemoryPoolSlabProviderRegion &assign) = delete;
+
+            SEAL_BYTE *const data_;
+
+            const page_type pages_;
+
+            mutable ReaderWriterLocker free_locker_{ "MemoryPoolSlabProviderRegion::free_locker_" };
+
+            // Free ranges by offset into the region
+            std::map<std::size_t, std::size_t> free_ranges_;
+        };
+
+        // Construction options for memory pools
+        struct MemoryPoolOptions
+        {
+            /*
+            Requested backing for allocations. Huge pages are only used for 
+            allocations of at least huge_page_byte_count bytes, and a request 
+            that cannot be satisfied falls back to transparent huge pages and 
+            then to standard pages. Only supported on Linux; elsewhere all 
+            allocations use standard pages.
+            */
+            page_type pages = page_type::standard;
+
+            // NUMA node the allocations are preferably placed on, or -1 for no 
+            // preference; only supported on Linux
+            int numa_node = -1;
+
+            /*
+            Alignment in bytes of every item handed out by the pool; must be a 
+            power of two no larger than max_pool_alignment. Items are padded to a multiple of 
+            the alignment, so that consecutive items never share a cache line.
+            */
+            std::size_t alignment = default_pool_alignment;
+
+            // Sizes of the allocations obtained from the system allocator
+            SlabGrowthPolicy growth;
+
+            // Ignored by pools that are not thread-safe
+            LockWaitPolicy lock_wait;
+
+            /*
+            If set, the data of every item is zeroed with secure_zero when it is 
+            returned to the pool, so that secrets do not linger in free items 
+            until the pool is destroyed. This costs one memset per release.
+            */
+            bool wipe_on_release = false;
+
+            MemoryPoolDebugOptions debug;
+
+            // If set, the memory obtained by the pool is charged to this quota, 
+            // which may be shared with other pools
+            std::shared_ptr<MemoryPoolQuota> quota;
+
+            // If set, all slabs are obtained from this provider, which may be 
+            // shared with other pools; pages, numa_node and debug.guard_pages 
+            // are then ignored
+            std::shared_ptr<MemoryPoolSlabProvider> slab_provider;
+        };
+
+        // Zeroes byte_count bytes at data in a way the compiler cannot elide 
+        // even if the memory is never read again
+        void secure_zero(void *data, std::size_t byte_count) noexcept;
+
+        // Snapshot of the activity of a memory pool head, or the sum over the 
+        // heads of a memory pool; counters are read without synchronization, 
+        // so a snapshot taken during concurrent use is approximate
+        struct MemoryPoolStats
+        {
+            // Items handed out and not yet returned
+            std::size_t outstanding_count = 0;
+
+            // Largest outstanding_count seen; for a memory pool this is the sum 
+            // over its heads. Thread-caching heads only sample it when items are 
+            // taken from the shared free list.
+            std::size_t peak_outstanding_count = 0;
+
+            // Total number of items handed out
+            std::size_t get_count = 0;
+
+            // Total number of items returned
+            std::size_t add_count = 0;
+
+            // Number of allocations obtained from the system allocator
+            std::size_t growth_count = 0;
+
+            // Time spent waiting for the lock of a thread-safe head
+            std::chrono::nanoseconds spin_time{ 0 };
+        };
+
+        // Size of a huge page (as used by x86-64 and AArch64 with 4 KB pages)
+        constexpr std::size_t huge_page_byte_count = std::size_t(1) << 21;
+
         class MemoryPoolItem
         {
         public:
@@ -50,14 +415,21 @@ namespace seal
                 return data_;
             }
 
-            inline MemoryPoolItem* &next() noexcept
+            /*
+            The link may be read by a thread popping from a lock-free free list 
+            while the thread that won the pop rewrites it, so it is atomic. A 
+            thread taking a chain of items walks the links past the head of the 
+            list, so they are read with acquire and written with release: each 
+            item reached this way is seen fully initialized.
+            */
+            inline MemoryPoolItem *next() const noexcept
             {
-                return next_;
+                return next_.load(std::memory_order_acquire);
             }
 
-            inline const MemoryPoolItem *next() const noexcept
+            inline void set_next(MemoryPoolItem *next) noexcept
             {
-                return next_;
+                next_.store(next, std::memory_order_release);
             }
 
         private:
@@ -67,7 +439,49 @@ namespace seal
 
             SEAL_BYTE *data_ = nullptr;
 
-            MemoryPoolItem *next_ = nullptr;
+            std::atomic<MemoryPoolItem*> next_{ nullptr };
+        };
+
+        // Released items held back from reuse in debug mode, oldest first
+        class MemoryPoolQuarantine
+        {
+        public:
+            // Appends an item; returns the oldest item if more than 
+            // max_item_count items are held, and nullptr otherwise
+            inline MemoryPoolItem *push(MemoryPoolItem *item, 
+                std::size_t max_item_count) noexcept
+            {
+                item->set_next(nullptr);
+                if (last_item_)
+                {
+                    last_item_->set_next(item);
+                }
+                else
+                {
+                    first_item_ = item;
+                }
+                last_item_ = item;
+                if (++item_count_ <= max_item_count)
+                {
+                    return nullptr;
+                }
+                MemoryPoolItem *oldest = first_item_;
+                first_item_ = oldest->next();
+                if (!first_item_)
+                {
+                    last_item_ = nullptr;
+                }
+                item_count_--;
+                oldest->set_next(nullptr);
+                return oldest;
+            }
+
+        private:
+            MemoryPoolItem *first_item_ = nullptr;
+
+            MemoryPoolItem *last_item_ = nullptr;
+
+            std::size_t item_count_ = 0;
         };
 
         class MemoryPoolHead
@@ -76,7 +490,9 @@ namespace seal
             struct allocation
             {
                 allocation() : 
-                    size(0), data_ptr(nullptr), free(0), head_ptr(nullptr)
+                    size(0), data_ptr(nullptr), free(0), head_ptr(nullptr),
+                    item_ptr(nullptr), mapped_byte_count(0), 
+                    pages(page_type::standard)
                 {
                 }
 
@@ -91,6 +507,17 @@ namespace seal
 
                 // Pointer to current head of allocation
                 SEAL_BYTE *head_ptr;
+
+                // Pointer to preallocated item records (one for each item); 
+                // these are never individually allocated or freed
+                MemoryPoolItem *item_ptr;
+
+                // Length of the mapping holding the data, or zero if the data 
+                // was obtained from operator new[]
+                std::size_t mapped_byte_count;
+
+                // Kind of pages actually backing the data
+                page_type pages;
             };
 
             // The overriding functions are noexcept(false)
@@ -99,21 +526,84 @@ namespace seal
             // Byte size of the allocations (items) owned by this pool
             virtual std::size_t item_byte_count() const noexcept = 0;
 
+            // Distance in bytes between consecutive items; this is item_byte_count 
+            // rounded up to a multiple of alignment
+            virtual std::size_t item_stride() const noexcept = 0;
+
+            // Alignment in bytes of every item
+            virtual std::size_t alignment() const noexcept = 0;
+
             // Total number of items allocated 
             virtual std::size_t item_count() const noexcept = 0;
 
+            // Number of allocations obtained from the system allocator
+            virtual std::size_t alloc_count() const noexcept = 0;
+
+            // Number of bytes allocated that are backed by the given kind of pages
+            virtual std::size_t page_byte_count(page_type pages) const noexcept = 0;
+
             virtual MemoryPoolItem *get() = 0;
 
             // Return item back to this pool
             virtual void add(MemoryPoolItem *new_first) noexcept = 0;
+
+            // Takes item_count items at once; if this throws no items are taken
+            virtual void get_batch(MemoryPoolItem **items, std::size_t item_count);
+
+            // Returns a chain of item_count items linked through next(), from 
+            // first to last, back to this pool
+            virtual void add_batch(MemoryPoolItem *first, MemoryPoolItem *last, 
+                std::size_t item_count) noexcept;
+
+            // Releases allocations all of whose items are free, most recent first, 
+            // until at least byte_count bytes have been released; returns the 
+            // number of bytes released
+            virtual std::size_t trim(std::size_t byte_count) = 0;
+
+            // Grows the pool with a single allocation so that it holds at least 
+            // item_count items in total
+            virtual void reserve(std::size_t item_count) = 0;
+
+            virtual MemoryPoolStats stats() const = 0;
+        };
+#ifdef SEAL_MEMPOOL_TRACE
+        enum class mempool_event : int
+        {
+            // An item was handed out
+            get = 0,
+
+            // An item was returned
+            add = 1,
+
+            // An allocation was obtained from the system allocator
+            grow = 2
         };
 
+        // Called on the thread causing the event, e.g. to record call stacks of 
+        // the code paths that make a pool grow; must not use the pool itself
+        using mempool_trace_hook = void (*)(mempool_event event, 
+            const MemoryPoolHead &head);
+
+        // Sets the hook receiving the events of all memory pool heads; nullptr 
+        // (the default) disables tracing
+        void set_mempool_trace_hook(mempool_trace_hook hook) noexcept;
+
+        void trace_mempool_event(mempool_event event, 
+            const MemoryPoolHead &head) noexcept;
+
+#define SEAL_MEMPOOL_TRACE_EVENT(event, head)                                       \
+    ::seal::util::trace_mempool_event(::seal::util::mempool_event::event, head)
+#else
+#define SEAL_MEMPOOL_TRACE_EVENT(event, head)
+#endif
+
         class MemoryPoolHeadMT : public MemoryPoolHead
         {
         public:
             // Creates a new MemoryPoolHeadMT with allocation for one single item.
             MemoryPoolHeadMT(std::size_t item_byte_count, 
-                bool clear_on_destruction = false);
+                bool clear_on_destruction = false,
+                const MemoryPoolOptions &options = MemoryPoolOptions());
 
             ~MemoryPoolHeadMT() noexcept override;
 
@@ -123,154 +613,981 @@ namespace seal
                 return item_byte_count_;
             }
 
+            inline std::size_t item_stride() const noexcept override
+            {
+                return item_stride_;
+            }
+
+            inline std::size_t alignment() const noexcept override
+            {
+                return options_.alignment;
+            }
+
             // Returns the total number of items allocated
             inline std::size_t item_count() const noexcept override
             {
-                return item_count_;
+                return item_count_.load(std::memory_order_relaxed);
+            }
+
+            // Returns the number of allocations obtained from the system allocator
+            inline std::size_t alloc_count() const noexcept override
+            {
+                return alloc_count_.load(std::memory_order_relaxed);
+            }
+
+            inline std::size_t page_byte_count(page_type pages) const noexcept override
+            {
+                return page_byte_counts_[static_cast<int>(pages)].load(
+                    std::memory_order_relaxed);
             }
 
             MemoryPoolItem *get() override;
 
             inline void add(MemoryPoolItem *new_first) noexcept override
             {
-                bool expected = false;
-                while (!locked_.compare_exchange_strong(
-                    expected, true, std::memory_order_acquire))
+                if (options_.debug.enabled)
                 {
-                    expected = false;
+                    add_debug(new_first);
+                    return;
                 }
-                MemoryPoolItem *old_first = first_item_;
-                new_first->next() = old_first;
-                first_item_ = new_first;
-                locked_.store(false, std::memory_order_release);
+                if (options_.wipe_on_release)
+                {
+                    secure_zero(new_first->data(), item_byte_count_);
+                }
+                add_count_.fetch_add(1, std::memory_order_relaxed);
+                SEAL_MEMPOOL_TRACE_EVENT(add, *this);
+                add_chain(new_first, new_first);
             }
 
-        private:
-            MemoryPoolHeadMT(const MemoryPoolHeadMT &copy) = delete;
+            // Takes items from the free list with a single compare-exchange and 
+            // carves or grows under a single lock if there are not enough
+            void get_batch(MemoryPoolItem **items, std::size_t item_count) override;
 
-            MemoryPoolHeadMT &operator =(const MemoryPoolHeadMT &assign) = delete;
+            // Splices the chain onto the free list with a single compare-exchange
+            void add_batch(MemoryPoolItem *first, MemoryPoolItem *last, 
+                std::size_t item_count) noexcept override;
 
-            const bool clear_on_destruction_;
+            // Can be called concurrently with get and add
+            std::size_t trim(std::size_t byte_count) override;
 
-            mutable std::atomic<bool> locked_;
+            void reserve(std::size_t item_count) override;
 
-            const std::size_t item_byte_count_;
+            MemoryPoolStats stats() const override;
 
-            volatile std::size_t item_count_;
+            // Returns a value that changes whenever items are handed out or 
+            // returned, whichever path serves them
+            virtual std::uint64_t activity() const
+            {
+                return static_cast<std::uint64_t>(get_count_.load(std::memory_order_relaxed)) + 
+                    add_count_.load(std::memory_order_relaxed);
+            }
 
-            std::vector<allocation> allocs_;
+        protected:
+            inline const MemoryPoolOptions &options() const noexcept
+            {
+                return options_;
+            }
 
-            MemoryPoolItem* volatile first_item_;
-        };
+            // Counts items handed out and updates the peak outstanding count
+            inline void count_get(std::size_t item_count = 1) noexcept
+            {
+#ifdef SEAL_MEMPOOL_TRACE
+                for (std::size_t i = 0; i < item_count; i++)
+                {
+                    SEAL_MEMPOOL_TRACE_EVENT(get, *this);
+                }
+#endif
+                std::size_t get_count = 
+                    get_count_.fetch_add(item_count, std::memory_order_relaxed) + item_count;
+                std::size_t add_count = add_count_.load(std::memory_order_relaxed);
+                if (add_count > get_count)
+                {
+                    // Items taken after ours have been returned already
+                    return;
+                }
+                std::size_t outstanding_count = get_count - add_count;
+                std::size_t peak = 
+                    peak_outstanding_count_.load(std::memory_order_relaxed);
+                while (outstanding_count > peak && 
+                    !peak_outstanding_count_.compare_exchange_weak(peak, 
+                        outstanding_count, std::memory_order_relaxed));
+            }
 
-        class MemoryPoolHeadST : public MemoryPoolHead
-        {
-        public:
-            // Creates a new MemoryPoolHeadST with allocation for one single item.
-            MemoryPoolHeadST(std::size_t item_byte_count,
-                bool clear_on_destruction = false);
+            // Counts items handed out and returned that bypassed get and add
+            inline void count_gets(std::size_t item_count) noexcept
+            {
+                get_count_.fetch_add(item_count, std::memory_order_relaxed);
+            }
 
-            ~MemoryPoolHeadST() noexcept override;
+            inline void count_adds(std::size_t item_count) noexcept
+            {
+                add_count_.fetch_add(item_count, std::memory_order_relaxed);
+            }
 
-            // Byte size of the allocations (items) owned by this pool
-            inline std::size_t item_byte_count() const noexcept override
+            // Pops the first item from the free list; returns nullptr if empty
+            inline MemoryPoolItem *try_pop() noexcept
             {
-                return item_byte_count_;
+                tagged_item_ptr old_first = first_item_.load(std::memory_order_acquire);
+                MemoryPoolItem *item;
+                while ((item = untag(old_first)) != nullptr)
+                {
+                    if (first_item_.compare_exchange_weak(old_first, 
+                        retag(item->next(), old_first), std::memory_order_acquire,
+                        std::memory_order_acquire))
+                    {
+                        item->set_next(nullptr);
+                        return item;
+                    }
+                }
+                return nullptr;
             }
 
-            // Returns the total number of items allocated
-            inline std::size_t item_count() const noexcept override
+            // Returns a chain of items linked through next() back to this pool
+            inline void add_chain(MemoryPoolItem *first, MemoryPoolItem *last) noexcept
             {
-                return item_count_;
+                tagged_item_ptr old_first = first_item_.load(std::memory_order_relaxed);
+                do
+                {
+                    last->set_next(untag(old_first));
+                } while (!first_item_.compare_exchange_weak(old_first, 
+                    retag(first, old_first), std::memory_order_release, 
+                    std::memory_order_relaxed));
             }
 
-            MemoryPoolItem *get() override;
+            // Pops up to item_count items from the free list with a single 
+            // compare-exchange; returns the number of items taken
+            std::size_t try_pop_chain(MemoryPoolItem **items, 
+                std::size_t item_count) noexcept;
 
-            inline void add(MemoryPoolItem *new_first) noexcept override
+            // Takes item_count items: as many as possible from the free list at 
+            // once, and the rest carved from the allocations under a single lock
+            void take_items(MemoryPoolItem **items, std::size_t item_count);
+
+        private:
+            /*
+            The free list is a lock-free (Treiber) stack. To make compare-exchange 
+            safe against ABA the head pointer is packed together with a tag that 
+            is incremented on every modification. Item records are never freed 
+            while the head is alive, so a stale first item can always be read. 
+            Records are aligned, so the low bits of their addresses are dropped 
+            to widen the tag; on 64-bit platforms it has 19 bits, and a stale 
+            compare-exchange can only succeed if a thread is preempted for 2^19 
+            modifications of the list and then finds the same first item.
+            */
+            using tagged_item_ptr = std::uint64_t;
+
+            static constexpr int item_align_shift = 
+                (alignof(MemoryPoolItem) >= 8) ? 3 : 2;
+
+            // On 64-bit platforms user-space addresses fit in the low 48 bits
+            static constexpr int tag_shift = 
+                ((sizeof(std::uintptr_t) == sizeof(std::uint64_t)) ? 48 : 32) - 
+                item_align_shift;
+
+            static constexpr tagged_item_ptr pointer_mask = 
+                (tagged_item_ptr(1) << tag_shift) - 1;
+
+            inline static MemoryPoolItem *untag(tagged_item_ptr tagged) noexcept
             {
-                new_first->next() = first_item_;
-                first_item_ = new_first;
+                return reinterpret_cast<MemoryPoolItem*>(static_cast<std::uintptr_t>(
+                    (tagged & pointer_mask) << item_align_shift));
             }
 
-        private:
-            MemoryPoolHeadST(const MemoryPoolHeadST &copy) = delete;
+            inline static tagged_item_ptr retag(MemoryPoolItem *item, 
+                tagged_item_ptr old_tagged) noexcept
+            {
+                return ((old_tagged & ~pointer_mask) + pointer_mask + 1) |
+                    (static_cast<tagged_item_ptr>(reinterpret_cast<std::uintptr_t>(item)) >> 
+                        item_align_shift);
+            }
 
-            MemoryPoolHeadST &operator =(const MemoryPoolHeadST &assign) = delete;
+            MemoryPoolHeadMT(const MemoryPoolHeadMT &copy) = delete;
 
-            const bool clear_on_destruction_;
+            MemoryPoolHeadMT &operator =(const MemoryPoolHeadMT &assign) = delete;
 
-            std::size_t item_byte_count_;
+            // Takes an item from the free list or the allocations
+            MemoryPoolItem *get_item();
 
-            std::size_t item_count_;
+            // Adds an allocation; must be called with locked_ held
+            void grow();
 
-            std::vector<allocation> allocs_;
+            // Poisons and quarantines an item in debug mode
+            void add_debug(MemoryPoolItem *new_first) noexcept;
 
-            MemoryPoolItem *first_item_;
-        };
+            // States of locked_
+            static constexpr std::uint32_t lock_free = 0;
 
-        class MemoryPool
-        {
-        public:
-            static constexpr double alloc_size_multiplier = 1.05;
+            static constexpr std::uint32_t lock_held = 1;
 
-            // Largest size of single allocation that can be requested from memory pool
-            static const std::size_t max_single_alloc_byte_count;
+            // Held, and threads may be parked waiting for it
+            static constexpr std::uint32_t lock_contended = 2;
 
-            // Number of different size allocations allowed by a single memory pool
-            static constexpr std::size_t max_pool_head_count = 
-                std::numeric_limits<std::size_t>::max();
+            // Acquires locked_ as given by options().lock_wait and accounts for 
+            // the time spent waiting
+            void lock() noexcept;
 
-            // Largest allowed size of batch allocation
-            static const std::size_t max_batch_alloc_byte_count;
+            inline void unlock() noexcept
+            {
+#ifdef SEAL_LOCK_PROFILE
+                profile_.record_hold(LockProfile::clock::now() - held_since_);
+#endif
+                if (locked_.state.exchange(lock_free, std::memory_order_release) == 
+                    lock_contended)
+                {
+                    wake_lock_waiter();
+                }
+            }
 
-            static constexpr std::size_t first_alloc_count = 1;
-            
-            virtual ~MemoryPool() = default;
+            // Wakes a thread parked in lock
+            void wake_lock_waiter() noexcept;
 
-            virtual Pointer<SEAL_BYTE> get_for_byte_count(std::size_t byte_count) = 0;
+            const bool clear_on_destruction_;
 
-            virtual std::size_t pool_count() const = 0;
+            const MemoryPoolOptions options_;
 
-            virtual std::size_t alloc_byte_count() const = 0;
-        };
+            std::atomic<std::size_t> page_byte_counts_[page_type_count];
 
-        class MemoryPoolMT : public MemoryPool
-        {
-        public:
-            MemoryPoolMT(bool clear_on_destruction = false) :
-                clear_on_destruction_(clear_on_destruction)
+            // Guards allocs_; only taken when the free list is empty. Sits alone 
+            // on a cache line, so that waiters do not slow down the free list.
+            struct alignas(64) lock_word
             {
+                std::atomic<std::uint32_t> state{ lock_free };
             };
 
-            ~MemoryPoolMT() noexcept override;
+            mutable lock_word locked_;
 
-            Pointer<SEAL_BYTE> get_for_byte_count(std::size_t byte_count) override;
+            const std::size_t item_byte_count_;
 
-            inline std::size_t pool_count() const override
-            {
-                ReaderLock lock(pools_locker_.acquire_read());
+            const std::size_t item_stride_;
+
+            // Written with locked_ held, but read without it
+            std::atomic<std::size_t> item_count_;
+
+            std::atomic<std::size_t> alloc_count_;
+
+            std::vector<allocation> allocs_;
+
+            // Item records of trimmed allocations; concurrent get calls may still 
+            // read them, so they are only freed when the head is destroyed
+            std::vector<MemoryPoolItem*> retired_item_ptrs_;
+
+            // Guarded by locked_
+            MemoryPoolQuarantine quarantine_;
+
+            std::atomic<tagged_item_ptr> first_item_;
+
+            std::atomic<std::size_t> get_count_{ 0 };
+
+            std::atomic<std::size_t> add_count_{ 0 };
+
+            std::atomic<std::size_t> peak_outstanding_count_{ 0 };
+
+            std::atomic<std::chrono::nanoseconds::rep> spin_time_{ 0 };
+#ifdef SEAL_LOCK_PROFILE
+            LockProfile profile_{ "MemoryPoolHeadMT", item_byte_count_ };
+
+            // Guarded by locked_
+            LockProfile::clock::time_point held_since_;
+#endif
+        };
+
+#ifndef _M_CEE
+        /*
+        A MemoryPoolHeadMT with a bounded per-thread cache (magazine) of free 
+        items in front of the shared free list. Magazines are refilled from and 
+        flushed to the shared free list in batches, so most get/add pairs touch 
+        only thread-local state. Items may be returned by any thread; when a 
+        thread exits its magazines are flushed back to their heads.
+        */
+        class MemoryPoolHeadTC : public MemoryPoolHeadMT
+        {
+        public:
+            struct magazine
+            {
+                // Guards against concurrent thread exit and head destruction
+                std::mutex mutex;
+
+                // Head owning the items; nullptr once the head is destroyed
+                std::atomic<MemoryPoolHeadTC*> owner{ nullptr };
+
+                // Set when the thread owning the magazine has exited
+                std::atomic<bool> retired{ false };
+
+                MemoryPoolItem *first_item = nullptr;
+
+                std::size_t item_count = 0;
+
+                // Items handed out and returned through the magazine; only 
+                // written by the owning thread
+                std::atomic<std::size_t> get_count{ 0 };
+
+                std::atomic<std::size_t> add_count{ 0 };
+
+                // Room for the items taken by one refill
+                std::vector<MemoryPoolItem*> refill_items;
+            };
+
+            // Creates a new MemoryPoolHeadTC with allocation for one single item.
+            MemoryPoolHeadTC(std::size_t item_byte_count, 
+                std::size_t magazine_item_count, bool clear_on_destruction = false,
+                const MemoryPoolOptions &options = MemoryPoolOptions());
+
+            ~MemoryPoolHeadTC() noexcept override;
+
+            MemoryPoolItem *get() override;
+
+            void add(MemoryPoolItem *new_first) noexcept override;
+
+            // Items cached by other threads keep their allocations alive
+            std::size_t trim(std::size_t byte_count) override;
+
+            // Includes the items served by the magazines of all threads
+            std::uint64_t activity() const override;
+
+            MemoryPoolStats stats() const override;
+
+            // Returns all items in the magazine to the shared free list and moves 
+            // its counters to the head
+            void flush(magazine &mag) noexcept;
+
+        private:
+            MemoryPoolHeadTC(const MemoryPoolHeadTC &copy) = delete;
+
+            MemoryPoolHeadTC &operator =(const MemoryPoolHeadTC &assign) = delete;
+
+            // Returns the calling thread's magazine or nullptr if it cannot be created
+            magazine *local_magazine() noexcept;
+
+            // Moves item_count items from the magazine to the shared free list
+            void flush(magazine &mag, std::size_t item_count) noexcept;
+
+            const std::size_t magazine_item_count_;
+
+            mutable std::mutex magazines_mutex_;
+
+            std::vector<std::shared_ptr<magazine>> magazines_;
+        };
+#endif
+        class MemoryPoolHeadST : public MemoryPoolHead
+        {
+        public:
+            // Creates a new MemoryPoolHeadST with allocation for one single item.
+            MemoryPoolHeadST(std::size_t item_byte_count,
+                bool clear_on_destruction = false,
+                const MemoryPoolOptions &options = MemoryPoolOptions());
+
+            ~MemoryPoolHeadST() noexcept override;
+
+            // Byte size of the allocations (items) owned by this pool
+            inline std::size_t item_byte_count() const noexcept override
+            {
+                return item_byte_count_;
+            }
+
+            inline std::size_t item_stride() const noexcept override
+            {
+                return item_stride_;
+            }
+
+            inline std::size_t alignment() const noexcept override
+            {
+                return options_.alignment;
+            }
+
+            // Returns the total number of items allocated
+            inline std::size_t item_count() const noexcept override
+            {
+                return item_count_;
+            }
+
+            // Returns the number of allocations obtained from the system allocator
+            inline std::size_t alloc_count() const noexcept override
+            {
+                return alloc_count_;
+            }
+
+            inline std::size_t page_byte_count(page_type pages) const noexcept override
+            {
+                return page_byte_counts_[static_cast<int>(pages)].load(
+                    std::memory_order_relaxed);
+            }
+
+            MemoryPoolItem *get() override;
+
+            inline void add(MemoryPoolItem *new_first) noexcept override
+            {
+                if (options_.debug.enabled)
+                {
+                    add_debug(new_first);
+                    return;
+                }
+                if (options_.wipe_on_release)
+                {
+                    secure_zero(new_first->data(), item_byte_count_);
+                }
+                add_count_++;
+                SEAL_MEMPOOL_TRACE_EVENT(add, *this);
+                new_first->set_next(first_item_);
+                first_item_ = new_first;
+            }
+
+            void add_batch(MemoryPoolItem *first, MemoryPoolItem *last, 
+                std::size_t item_count) noexcept override;
+
+            std::size_t trim(std::size_t byte_count) override;
+
+            void reserve(std::size_t item_count) override;
+
+            MemoryPoolStats stats() const override;
+
+        private:
+            inline void count_get() noexcept
+            {
+                get_count_++;
+                peak_outstanding_count_ = std::max(
+                    peak_outstanding_count_, get_count_ - add_count_);
+                SEAL_MEMPOOL_TRACE_EVENT(get, *this);
+            }
+
+            // Takes an item from the free list or the allocations
+            MemoryPoolItem *get_item();
+
+            void add_debug(MemoryPoolItem *new_first) noexcept;
+
+            MemoryPoolHeadST(const MemoryPoolHeadST &copy) = delete;
+
+            MemoryPoolHeadST &operator =(const MemoryPoolHeadST &assign) = delete;
+
+            const bool clear_on_destruction_;
+
+            const MemoryPoolOptions options_;
+
+            std::atomic<std::size_t> page_byte_counts_[page_type_count];
+
+            std::size_t item_byte_count_;
+
+            std::size_t item_stride_;
+
+            std::size_t item_count_;
+
+            std::size_t alloc_count_;
+
+            std::vector<allocation> allocs_;
+
+            MemoryPoolItem *first_item_;
+
+            MemoryPoolQuarantine quarantine_;
+
+            std::size_t get_count_ = 0;
+
+            std::size_t add_count_ = 0;
+
+            std::size_t peak_outstanding_count_ = 0;
+        };
+
+        class MemoryPoolArena;
+
+        class MemoryPoolShared;
+
+        // Pool head of a MemoryPoolArena; items are carved from the chunks of 
+        // the arena and never reused before the arena is reset
+        class MemoryPoolHeadArena : public MemoryPoolHead
+        {
+        public:
+            MemoryPoolHeadArena(std::size_t item_byte_count, MemoryPoolArena &arena);
+
+            // Byte size of the allocations (items) owned by this pool
+            inline std::size_t item_byte_count() const noexcept override
+            {
+                return item_byte_count_;
+            }
+
+            inline std::size_t item_stride() const noexcept override
+            {
+                return item_stride_;
+            }
+
+            std::size_t alignment() const noexcept override;
+
+            // Returns the number of items handed out since the arena was reset
+            std::size_t item_count() const noexcept override;
+
+            // The memory is owned by the arena
+            inline std::size_t alloc_count() const noexcept override
+            {
+                return 0;
+            }
+
+            inline std::size_t page_byte_count(page_type) const noexcept override
+            {
+                return 0;
+            }
+
+            MemoryPoolItem *get() override;
+
+            void add(MemoryPoolItem *new_first) noexcept override;
+
+            // Memory is only released by the arena
+            inline std::size_t trim(std::size_t) override
+            {
+                return 0;
+            }
+
+            void reserve(std::size_t item_count) override;
+
+            MemoryPoolStats stats() const override;
+
+        private:
+            friend class MemoryPoolArena;
+
+            MemoryPoolHeadArena(const MemoryPoolHeadArena &copy) = delete;
+
+            MemoryPoolHeadArena &operator =(const MemoryPoolHeadArena &assign) = delete;
+
+            MemoryPoolArena &arena_;
+
+            const std::size_t item_byte_count_;
+
+            const std::size_t item_stride_;
+
+            // Items handed out since the arena was reset epoch_ times
+            std::size_t item_count_ = 0;
+
+            std::size_t epoch_ = 0;
+
+            std::size_t get_count_ = 0;
+
+            std::size_t add_count_ = 0;
+
+            std::size_t peak_outstanding_count_ = 0;
+        };
+
+        // Pool head of a MemoryPoolShared; the free items of its size live in 
+        // the shared segment, and only the item records are local to the process
+        class MemoryPoolHeadShared : public MemoryPoolHead
+        {
+        public:
+            MemoryPoolHeadShared(std::size_t item_byte_count, 
+                std::size_t class_index, MemoryPoolShared &pool) noexcept : 
+                pool_(pool), item_byte_count_(item_byte_count), 
+                class_index_(class_index)
+            {
+            }
+
+            ~MemoryPoolHeadShared() noexcept override;
+
+            inline std::size_t item_byte_count() const noexcept override
+            {
+                return item_byte_count_;
+            }
+
+            // Items are powers of two no smaller than the alignment
+            inline std::size_t item_stride() const noexcept override
+            {
+                return item_byte_count_;
+            }
+
+            std::size_t alignment() const noexcept override;
+
+            // Returns the number of items carved from the segment by all processes
+            std::size_t item_count() const noexcept override;
+
+            // The memory is owned by the shared segment
+            inline std::size_t alloc_count() const noexcept override
+            {
+                return 0;
+            }
+
+            inline std::size_t page_byte_count(page_type) const noexcept override
+            {
+                return 0;
+            }
+
+            MemoryPoolItem *get() override;
+
+            void add(MemoryPoolItem *new_first) noexcept override;
+
+            // Memory is only released when the segment is removed
+            inline std::size_t trim(std::size_t) override
+            {
+                return 0;
+            }
+
+            void reserve(std::size_t item_count) override;
+
+            MemoryPoolStats stats() const override;
+
+        private:
+            friend class MemoryPoolShared;
+
+            MemoryPoolHeadShared(const MemoryPoolHeadShared &copy) = delete;
+
+            MemoryPoolHeadShared &operator =(const MemoryPoolHeadShared &assign) = delete;
+
+            // Returns an item record for data, reusing a spare one if possible
+            MemoryPoolItem *new_item(SEAL_BYTE *data);
+
+            // Keeps the record of an item that left this process for reuse
+            void delete_item(MemoryPoolItem *item) noexcept;
+
+            MemoryPoolShared &pool_;
+
+            const std::size_t item_byte_count_;
+
+            const std::size_t class_index_;
+
+            std::atomic<bool> records_locked_{ false };
+
+            MemoryPoolItem *spare_items_ = nullptr;
+
+            std::atomic<std::size_t> outstanding_count_{ 0 };
+
+            std::atomic<std::size_t> peak_outstanding_count_{ 0 };
+
+            std::atomic<std::size_t> get_count_{ 0 };
+
+            std::atomic<std::size_t> add_count_{ 0 };
+        };
+
+        /*
+        Policy for rounding requested allocation sizes up to a bounded set of 
+        size classes. A memory pool creates one head for every distinct size it 
+        serves, so rounding trades some internal fragmentation for fewer heads 
+        (and fewer allocations held by them). Sizes above the largest class of 
+        a policy are served exactly.
+        */
+        class SizeClassPolicy
+        {
+        public:
+            // Every byte count is its own size class (no rounding)
+            SizeClassPolicy() = default;
+
+            inline static SizeClassPolicy Exact() noexcept
+            {
+                return SizeClassPolicy();
+            }
+
+            // Round up to the next power of two
+            inline static SizeClassPolicy PowerOfTwo() noexcept
+            {
+                return SizeClassPolicy(policy_type::power_of_two, 0, {});
+            }
+
+            // Round up with 2^spacing_bits evenly spaced classes between any two 
+            // consecutive powers of two (jemalloc-style); spacing_bits = 2 wastes 
+            // at most 20% of an allocation
+            inline static SizeClassPolicy Spaced(int spacing_bits = 2)
+            {
+                if (spacing_bits < 0 || spacing_bits > 16)
+                {
+                    throw std::invalid_argument("invalid spacing_bits");
+                }
+                return SizeClassPolicy(policy_type::spaced, spacing_bits, {});
+            }
+
+            // Round up to the smallest of the given byte counts that fits
+            static SizeClassPolicy Table(std::vector<std::size_t> byte_counts);
+
+            inline bool is_exact() const noexcept
+            {
+                return type_ == policy_type::exact;
+            }
+
+            // Returns the size class for a non-zero byte count
+            std::size_t round(std::size_t byte_count) const noexcept;
+
+        private:
+            enum class policy_type
+            {
+                exact,
+                power_of_two,
+                spaced,
+                table
+            };
+
+            SizeClassPolicy(policy_type type, int spacing_bits, 
+                std::vector<std::size_t> byte_counts) :
+                type_(type), spacing_bits_(spacing_bits), 
+                byte_counts_(std::move(byte_counts))
+            {
+            }
+
+            policy_type type_ = policy_type::exact;
+
+            int spacing_bits_ = 0;
+
+            std::vector<std::size_t> byte_counts_;
+        };
+
+        class MemoryPool
+        {
+        public:
+            static constexpr double alloc_size_multiplier = 1.05;
+
+            // Largest size of single allocation that can be requested from memory pool
+            static const std::size_t max_single_alloc_byte_count;
+
+            // Number of different size allocations allowed by a single memory pool
+            static constexpr std::size_t max_pool_head_count = 
+                std::numeric_limits<std::size_t>::max();
+
+            // Largest allowed size of batch allocation
+            static const std::size_t max_batch_alloc_byte_count;
+
+            static constexpr std::size_t first_alloc_count = 1;
+            
+            virtual ~MemoryPool() = default;
+
+            virtual Pointer<SEAL_BYTE> get_for_byte_count(std::size_t byte_count) = 0;
+
+            // Hands out item_count allocations of byte_count bytes each, taking 
+            // them from the pool head in a single batch
+            std::vector<Pointer<SEAL_BYTE>> get_batch(
+                std::size_t byte_count, std::size_t item_count);
+
+            // Releases the given pointers, returning consecutive allocations from 
+            // the same pool head as a single chain; the pointers are left unset
+            static void release_batch(std::vector<Pointer<SEAL_BYTE>> &pointers) noexcept;
+
+            // Makes sure that at least item_count allocations of byte_count bytes 
+            // fit in the pool in total, using a single new allocation from the 
+            // system allocator if more memory is needed
+            virtual void reserve(std::size_t byte_count, std::size_t item_count) = 0;
+
+            virtual std::size_t pool_count() const = 0;
+
+            // Number of bytes allocated, including the padding of items to the 
+            // alignment of the pool
+            virtual std::size_t alloc_byte_count() const = 0;
+
+            // Alignment in bytes of every allocation handed out by the pool
+            virtual std::size_t alignment() const noexcept = 0;
+
+            // Number of allocations obtained from the system allocator; in steady 
+            // state (no new sizes and no slab growth) this stays constant
+            virtual std::size_t alloc_count() const = 0;
+
+            // Pairs of item byte count and number of items allocated for every 
+            // size the pool serves, largest size first
+            virtual std::vector<std::pair<std::size_t, std::size_t>> 
+                size_histogram() const = 0;
+
+            // Sum of the statistics of all heads
+            virtual MemoryPoolStats stats() const = 0;
+
+            // Number of bytes allocated that are backed by the given kind of pages
+            virtual std::size_t page_byte_count(page_type pages) const = 0;
+
+            // Releases memory held by fully free allocations until alloc_byte_count 
+            // is at most byte_count (if possible); returns the number of bytes released
+            virtual std::size_t shrink_to(std::size_t byte_count) = 0;
+
+            // Releases memory held by all fully free allocations
+            inline std::size_t trim()
+            {
+                return shrink_to(0);
+            }
+
+            inline const SizeClassPolicy &size_classes() const noexcept
+            {
+                return size_classes_;
+            }
+
+            // Total bytes requested through get_for_byte_count, counted only when 
+            // the size class policy rounds sizes
+            inline std::size_t requested_byte_count() const noexcept
+            {
+                return requested_byte_count_.load(std::memory_order_relaxed);
+            }
+
+            // Total bytes handed out for the requests counted by 
+            // requested_byte_count; the difference is internal fragmentation
+            inline std::size_t rounded_byte_count() const noexcept
+            {
+                return rounded_byte_count_.load(std::memory_order_relaxed);
+            }
+
+        protected:
+            MemoryPool(SizeClassPolicy size_classes = SizeClassPolicy()) :
+                size_classes_(std::move(size_classes))
+            {
+            }
+
+            // Throws std::invalid_argument if options are not valid
+            static const MemoryPoolOptions &validate(const MemoryPoolOptions &options);
+
+            // Returns the pool head for a (rounded) byte count, creating it if needed
+            virtual MemoryPoolHead *get_head(std::size_t byte_count) = 0;
+
+            // Applies the size class policy to a non-zero byte count, counting 
+            // item_count requests of that size
+            inline std::size_t round_byte_count(std::size_t byte_count, 
+                std::size_t item_count = 1) noexcept
+            {
+                if (size_classes_.is_exact())
+                {
+                    return byte_count;
+                }
+                std::size_t rounded = size_classes_.round(byte_count);
+                requested_byte_count_.fetch_add(byte_count * item_count, 
+                    std::memory_order_relaxed);
+                rounded_byte_count_.fetch_add(rounded * item_count, 
+                    std::memory_order_relaxed);
+                return rounded;
+            }
+
+            const SizeClassPolicy size_classes_;
+
+            std::atomic<std::size_t> requested_byte_count_{ 0 };
+
+            std::atomic<std::size_t> rounded_byte_count_{ 0 };
+        };
+
+        class MemoryPoolMT : public MemoryPool
+        {
+        public:
+            MemoryPoolMT(bool clear_on_destruction = false, 
+                SizeClassPolicy size_classes = SizeClassPolicy(),
+                MemoryPoolOptions options = MemoryPoolOptions()) :
+                MemoryPool(std::move(size_classes)),
+                clear_on_destruction_(clear_on_destruction), 
+                options_(validate(options))
+            {
+            };
+
+            ~MemoryPoolMT() noexcept override;
+
+            Pointer<SEAL_BYTE> get_for_byte_count(std::size_t byte_count) override;
+
+            void reserve(std::size_t byte_count, std::size_t item_count) override;
+
+            inline std::size_t pool_count() const override
+            {
+                ReaderLock lock(pools_locker_.acquire_read());
                 return pools_.size();
             }
 
             std::size_t alloc_byte_count() const override;
 
+            inline std::size_t alignment() const noexcept override
+            {
+                return options_.alignment;
+            }
+
+            std::size_t alloc_count() const override;
+
+            std::vector<std::pair<std::size_t, std::size_t>> 
+                size_histogram() const override;
+
+            MemoryPoolStats stats() const override;
+
+            std::size_t page_byte_count(page_type pages) const override;
+
+            std::size_t shrink_to(std::size_t byte_count) override;
+#ifndef _M_CEE
+            // Trims the heads that have handed out and taken back no items, on 
+            // any path, for at least idle_time, as observed by previous calls to 
+            // this function; meant to be called periodically (see MemoryPoolTrimmer)
+            std::size_t trim_idle(std::chrono::steady_clock::duration idle_time);
+#endif
         protected:
             MemoryPoolMT(const MemoryPoolMT &copy) = delete;
 
             MemoryPoolMT &operator =(const MemoryPoolMT &assign) = delete;
 
+            // Creates the pool head for a new allocation size
+            virtual MemoryPoolHeadMT *new_head(std::size_t byte_count);
+
+            // Returns the pool head for a (rounded) byte count, creating it if needed
+            MemoryPoolHead *get_head(std::size_t byte_count) override;
+
+            // Finds the pool head for byte_count without locking; returns nullptr 
+            // if there is no such head (yet)
+            MemoryPoolHead *find_head(std::size_t byte_count) const noexcept;
+
+            // Makes a new pool head visible to find_head; requires the writer lock
+            void publish_head(MemoryPoolHead *head);
+
+            /*
+            Open-addressed (linear probing) hash table from byte count to pool 
+            head. Slots are only ever filled and never cleared, so readers probe 
+            without locking. A table is never filled past one half; instead a 
+            larger copy is published and the old one is retired. Retired tables 
+            are kept until the pool is destroyed, since readers may still be 
+            probing them; their total size is bounded by that of the current one.
+            */
+            struct head_table
+            {
+                head_table(int capacity_bits);
+
+                const int capacity_bits;
+
+                std::size_t head_count = 0;
+
+                std::unique_ptr<std::atomic<MemoryPoolHead*>[]> slots;
+            };
+
             const bool clear_on_destruction_;
 
-            mutable ReaderWriterLocker pools_locker_;
+            const MemoryPoolOptions options_;
+
+            mutable ReaderWriterLocker pools_locker_{ "MemoryPoolMT::pools_locker_" };
 
             std::vector<MemoryPoolHead*> pools_;
+
+            std::atomic<head_table*> heads_{ nullptr };
+
+            std::vector<std::unique_ptr<head_table>> head_tables_;
+#ifndef _M_CEE
+            struct idle_state
+            {
+                std::uint64_t activity;
+
+                std::chrono::steady_clock::time_point since;
+            };
+
+            std::mutex idle_mutex_;
+
+            std::unordered_map<const MemoryPoolHead*, idle_state> idle_states_;
+#endif
         };
+#ifndef _M_CEE
+        // A thread-safe memory pool whose heads keep per-thread caches of items
+        class MemoryPoolTC : public MemoryPoolMT
+        {
+        public:
+            static constexpr std::size_t default_magazine_item_count = 32;
+
+            MemoryPoolTC(bool clear_on_destruction = false, 
+                std::size_t magazine_item_count = default_magazine_item_count,
+                SizeClassPolicy size_classes = SizeClassPolicy(),
+                MemoryPoolOptions options = MemoryPoolOptions()) :
+                MemoryPoolMT(clear_on_destruction, std::move(size_classes), 
+                    std::move(options)), 
+                magazine_item_count_(magazine_item_count)
+            {
+                if (magazine_item_count_ == 0)
+                {
+                    throw std::invalid_argument("invalid magazine size");
+                }
+            };
+
+        protected:
+            MemoryPoolHeadMT *new_head(std::size_t byte_count) override;
+
+            const std::size_t magazine_item_count_;
+        };
+#endif
 
         class MemoryPoolST : public MemoryPool
         {
         public:
-            MemoryPoolST(bool clear_on_destruction = false) :
-                clear_on_destruction_(clear_on_destruction)
+            MemoryPoolST(bool clear_on_destruction = false, 
+                SizeClassPolicy size_classes = SizeClassPolicy(),
+                MemoryPoolOptions options = MemoryPoolOptions()) :
+                MemoryPool(std::move(size_classes)),
+                clear_on_destruction_(clear_on_destruction), 
+                options_(validate(options))
             {
             };
 
@@ -278,21 +1595,334 @@ namespace seal
 
             Pointer<SEAL_BYTE> get_for_byte_count(std::size_t byte_count) override;
 
+            void reserve(std::size_t byte_count, std::size_t item_count) override;
+
             inline std::size_t pool_count() const override
             {
                 return pools_.size();
             }
 
             std::size_t alloc_byte_count() const override;
+
+            inline std::size_t alignment() const noexcept override
+            {
+                return options_.alignment;
+            }
+
+            std::size_t alloc_count() const override;
+
+            std::vector<std::pair<std::size_t, std::size_t>> 
+                size_histogram() const override;
+
+            MemoryPoolStats stats() const override;
+
+            std::size_t page_byte_count(page_type pages) const override;
+
+            std::size_t shrink_to(std::size_t byte_count) override;
             
         protected:
             MemoryPoolST(const MemoryPoolST &copy) = delete;
 
             MemoryPoolST &operator =(const MemoryPoolST &assign) = delete;
 
+            // Returns the pool head for a (rounded) byte count, creating it if needed
+            MemoryPoolHead *get_head(std::size_t byte_count) override;
+
+            const bool clear_on_destruction_;
+
+            const MemoryPoolOptions options_;
+
+            std::vector<MemoryPoolHead*> pools_;
+        };
+
+        /*
+        A memory pool that hands out memory by bumping a pointer through large 
+        chunks. Returning an allocation does not make its memory available 
+        again; instead reset makes all chunks available at once, in constant 
+        time. Item data is carved upwards from the start of a chunk at the 
+        item stride, and the item records are packed downwards from its end. 
+        This suits request-scoped scratch memory that is allocated and released 
+        many times within a request, e.g. through MMProfFixed together with a 
+        MemoryPoolArenaScope. Like MemoryPoolST this is not thread-safe.
+        */
+        class MemoryPoolArena : public MemoryPool
+        {
+        public:
+            static constexpr std::size_t default_chunk_byte_count = std::size_t(1) << 20;
+
+            // Allocations larger than chunk_byte_count get a chunk of their own
+            MemoryPoolArena(std::size_t chunk_byte_count = default_chunk_byte_count,
+                bool clear_on_destruction = false, 
+                SizeClassPolicy size_classes = SizeClassPolicy(),
+                MemoryPoolOptions options = MemoryPoolOptions());
+
+            ~MemoryPoolArena() noexcept override;
+
+            Pointer<SEAL_BYTE> get_for_byte_count(std::size_t byte_count) override;
+
+            void reserve(std::size_t byte_count, std::size_t item_count) override;
+
+            inline std::size_t pool_count() const override
+            {
+                return pools_.size();
+            }
+
+            std::size_t alloc_byte_count() const override;
+
+            inline std::size_t alignment() const noexcept override
+            {
+                return options_.alignment;
+            }
+
+            // Returns the number of chunks obtained from the system allocator
+            inline std::size_t alloc_count() const override
+            {
+                return alloc_count_;
+            }
+
+            // Pairs of item byte count and number of items handed out since the 
+            // last reset, largest size first
+            std::vector<std::pair<std::size_t, std::size_t>> 
+                size_histogram() const override;
+
+            MemoryPoolStats stats() const override;
+
+            std::size_t page_byte_count(page_type pages) const override;
+
+            // Releases chunks that are not in use, most recent first
+            std::size_t shrink_to(std::size_t byte_count) override;
+
+            // Number of allocations handed out and not yet returned
+            inline std::size_t outstanding_count() const noexcept
+            {
+                return outstanding_count_;
+            }
+
+            // Makes the memory of all chunks available again; throws 
+            // std::logic_error if any allocations are outstanding
+            void reset();
+
+        protected:
+            MemoryPoolArena(const MemoryPoolArena &copy) = delete;
+
+            MemoryPoolArena &operator =(const MemoryPoolArena &assign) = delete;
+
+            // Returns the pool head for a (rounded) byte count, creating it if needed
+            MemoryPoolHead *get_head(std::size_t byte_count) override;
+
+        private:
+            friend class MemoryPoolHeadArena;
+
+            // Memory shared by items of all sizes, so unlike the allocations of 
+            // a pool head it is measured in bytes
+            struct arena_chunk
+            {
+                SEAL_BYTE *data_ptr = nullptr;
+
+                std::size_t byte_count = 0;
+
+                // Length of the mapping holding the data, or zero if the data 
+                // was obtained from operator new[]
+                std::size_t mapped_byte_count = 0;
+
+                // Kind of pages actually backing the data
+                page_type pages = page_type::standard;
+            };
+
+            // Carves an item record and item_stride bytes of data from the chunks
+            MemoryPoolItem *carve(std::size_t item_stride);
+
+            // Makes sure that the chunks have room for item_count items of 
+            // item_stride bytes without obtaining more memory
+            void reserve_items(std::size_t item_stride, std::size_t item_count);
+
+            // Appends an unused chunk with room for at least item_count items 
+            // of item_stride bytes
+            void add_chunk(std::size_t item_stride, std::size_t item_count);
+
+            // Makes chunks_[index] the current chunk, with all of its room
+            void start_chunk(std::size_t index) noexcept;
+
+            // Clears the chunk if clear_on_destruction is set and frees it
+            void delete_chunk(arena_chunk &chunk) noexcept;
+
+            // End of the item records of a chunk, aligned for them
+            inline static SEAL_BYTE *records_end(const arena_chunk &chunk) noexcept
+            {
+                auto end = reinterpret_cast<std::uintptr_t>(chunk.data_ptr + chunk.byte_count);
+                return reinterpret_cast<SEAL_BYTE*>(
+                    end & ~static_cast<std::uintptr_t>(alignof(MemoryPoolItem) - 1));
+            }
+
+            const std::size_t chunk_byte_count_;
+
             const bool clear_on_destruction_;
 
+            const MemoryPoolOptions options_;
+
             std::vector<MemoryPoolHead*> pools_;
+
+            // The chunks after current_chunk_ are unused, and the ones before it 
+            // are not carved from again until reset
+            std::vector<arena_chunk> chunks_;
+
+            std::size_t current_chunk_ = 0;
+
+            // Room left in the current chunk; both are nullptr if no chunk was 
+            // started since the arena was created, reset or emptied by shrink_to
+            SEAL_BYTE *data_cursor_ = nullptr;
+
+            SEAL_BYTE *record_cursor_ = nullptr;
+
+            // Number of resets so far
+            std::size_t epoch_ = 0;
+
+            std::size_t alloc_count_ = 0;
+
+            std::size_t outstanding_count_ = 0;
+        };
+
+        /*
+        A thread-safe memory pool whose memory lives in a named POSIX shared 
+        memory segment, so that several processes opening the same name share 
+        it. Allocations are powers of two of at least default_pool_alignment 
+        bytes, carved from the segment and kept on free lists linked by offsets, 
+        so that every process can use them wherever the segment is mapped.
+
+        An allocation is handed to another process by its offset: the sender 
+        calls detach, which gives up ownership without freeing the memory, and 
+        the receiver calls adopt with the offset and the byte count to get a 
+        Pointer that returns the memory to the shared free lists when released. 
+        Allocations of a process that exits without releasing them are lost 
+        until the segment is removed, as is the segment if a process dies 
+        while it updates the free lists. Only supported on Linux.
+        */
+        class MemoryPoolShared : public MemoryPool
+        {
+        public:
+            /*
+            Opens the shared memory segment with the given name, creating it 
+            with byte_count bytes if it does not exist. The segment persists 
+            until removed with remove, even after all pools using it are 
+            destroyed.
+            */
+            MemoryPoolShared(const std::string &name, std::size_t byte_count);
+
+            ~MemoryPoolShared() noexcept override;
+
+            // Removes the name of a shared memory segment; processes that have 
+            // it open keep using it. Returns false if there was no such segment.
+            static bool remove(const std::string &name) noexcept;
+
+            Pointer<SEAL_BYTE> get_for_byte_count(std::size_t byte_count) override;
+
+            void reserve(std::size_t byte_count, std::size_t item_count) override;
+
+            std::size_t pool_count() const override;
+
+            // Returns the number of bytes carved from the segment by all processes
+            std::size_t alloc_byte_count() const override;
+
+            inline std::size_t alignment() const noexcept override
+            {
+                return default_pool_alignment;
+            }
+
+            // The segment is the only memory obtained from the system
+            inline std::size_t alloc_count() const override
+            {
+                return 1;
+            }
+
+            // Pairs of item byte count and number of items carved from the 
+            // segment by all processes, largest size first
+            std::vector<std::pair<std::size_t, std::size_t>> 
+                size_histogram() const override;
+
+            MemoryPoolStats stats() const override;
+
+            std::size_t page_byte_count(page_type pages) const override;
+
+            // Memory is only released when the segment is removed
+            inline std::size_t shrink_to(std::size_t) override
+            {
+                return 0;
+            }
+
+            inline const std::string &name() const noexcept
+            {
+                return name_;
+            }
+
+            // Size of the shared segment in bytes
+            inline std::size_t segment_byte_count() const noexcept
+            {
+                return segment_byte_count_;
+            }
+
+            // Returns the offset of data in the segment; throws 
+            // std::invalid_argument if data does not point into the segment
+            std::size_t offset_of(const void *data) const;
+
+            // Returns the address of an offset in the segment in this process
+            SEAL_BYTE *data_at(std::size_t offset) const;
+
+            /*
+            Gives up ownership of an allocation of this pool without returning 
+            it to the pool and returns its offset, to be adopted by this or 
+            another process. The pointer is left unset. Destructors of its 
+            elements do not run.
+            */
+            template<typename T>
+            std::size_t detach(Pointer<T> &&pointer)
+            {
+                auto head = dynamic_cast<MemoryPoolHeadShared*>(pointer.head_);
+                if (!head || &head->pool_ != this)
+                {
+                    throw std::invalid_argument("pointer is not from this pool");
+                }
+                std::size_t offset = offset_of(pointer.item_->data());
+                head->delete_item(pointer.item_);
+                pointer.data_ = nullptr;
+                pointer.head_ = nullptr;
+                pointer.item_ = nullptr;
+                pointer.alias_ = false;
+                return offset;
+            }
+
+            // Takes ownership of an allocation of byte_count bytes at offset that 
+            // was detached, possibly by another process
+            Pointer<SEAL_BYTE> adopt(std::size_t offset, std::size_t byte_count);
+
+        protected:
+            MemoryPoolShared(const MemoryPoolShared &copy) = delete;
+
+            MemoryPoolShared &operator =(const MemoryPoolShared &assign) = delete;
+
+            MemoryPoolHead *get_head(std::size_t byte_count) override;
+
+        private:
+            friend class MemoryPoolHeadShared;
+
+            // Takes an item of 2^class_index bytes from the segment
+            SEAL_BYTE *pop(std::size_t class_index);
+
+            // Returns a chain of item_count items of 2^class_index bytes, linked 
+            // through their first bytes, to the segment
+            void push(std::size_t class_index, SEAL_BYTE *first, SEAL_BYTE *last) noexcept;
+
+            void lock() const noexcept;
+
+            void unlock() const noexcept;
+
+            const std::string name_;
+
+            SEAL_BYTE *segment_ = nullptr;
+
+            std::size_t segment_byte_count_ = 0;
+
+            // One head per power of two, indexed by its exponent
+            std::vector<std::unique_ptr<MemoryPoolHeadShared>> pools_;
         };
     }
 }
@@ -9,6 +9,8 @@
 #include <type_traits>
 #include <memory>
 #include <utility>
+#include <cstdint>
+#include <stdexcept>
 
 namespace seal
 {
@@ -18,8 +20,11 @@ namespace seal
         template<>
         class Pointer<SEAL_BYTE>
         {
+            friend class MemoryPool;
             friend class MemoryPoolST;
             friend class MemoryPoolMT;
+            friend class MemoryPoolArena;
+            friend class MemoryPoolShared;
 
         public:
             template<typename, typename> friend class Pointer;
@@ -200,6 +205,12 @@ namespace seal
                 data_ = item_->data();
             }
 
+            // Takes ownership of an item already obtained from head
+            Pointer(class MemoryPoolHead *head, MemoryPoolItem *item) noexcept :
+                data_(item->data()), head_(head), item_(item)
+            {
+            }
+
             SEAL_BYTE *data_ = nullptr;
 
             MemoryPoolHead *head_ = nullptr;
@@ -214,6 +225,8 @@ namespace seal
         {
             friend class MemoryPoolST;
             friend class MemoryPoolMT;
+            friend class MemoryPoolArena;
+            friend class MemoryPoolShared;
 
         public:
             friend class Pointer<SEAL_BYTE>;
@@ -330,6 +343,40 @@ namespace seal
                 return data_;
             }
 
+            // Alignment in bytes guaranteed for the data: the alignment of the 
+            // pool for pool memory, and only alignof(T) otherwise
+            inline std::size_t alignment() const noexcept
+            {
+                return head_ ? head_->alignment() : alignof(T);
+            }
+
+            // Returns the data with the given alignment made known to the compiler, 
+            // so that vectorized code can use aligned loads and stores; requires 
+            // alignment() to be at least Alignment
+            template<std::size_t Alignment = default_pool_alignment>
+            inline T *get_aligned()
+            {
+#ifdef SEAL_DEBUG
+                if (reinterpret_cast<std::uintptr_t>(data_) % Alignment)
+                {
+                    throw std::logic_error("data is not aligned");
+                }
+#endif
+                return static_cast<T*>(SEAL_ASSUME_ALIGNED(data_, Alignment));
+            }
+
+            template<std::size_t Alignment = default_pool_alignment>
+            inline const T *get_aligned() const
+            {
+#ifdef SEAL_DEBUG
+                if (reinterpret_cast<std::uintptr_t>(data_) % Alignment)
+                {
+                    throw std::logic_error("data is not aligned");
+                }
+#endif
+                return static_cast<const T*>(SEAL_ASSUME_ALIGNED(data_, Alignment));
+            }
+
             inline T *operator ->() noexcept
             {
                 return data_;
@@ -542,6 +589,7 @@ namespace seal
         {
             friend class MemoryPoolST;
             friend class MemoryPoolMT;
+            friend class MemoryPoolArena;
 
         public:
             template<typename, typename> friend class ConstPointer;
@@ -756,6 +804,7 @@ namespace seal
         {
             friend class MemoryPoolST;
             friend class MemoryPoolMT;
+            friend class MemoryPoolArena;
 
         public:
             ConstPointer() = default;
@@ -941,6 +990,25 @@ namespace seal
                 return data_;
             }
 
+            // Alignment in bytes guaranteed for the data: the alignment of the 
+            // pool for pool memory, and only alignof(T) otherwise
+            inline std::size_t alignment() const noexcept
+            {
+                return head_ ? head_->alignment() : alignof(T);
+            }
+
+            template<std::size_t Alignment = default_pool_alignment>
+            inline const T *get_aligned() const
+            {
+#ifdef SEAL_DEBUG
+                if (reinterpret_cast<std::uintptr_t>(data_) % Alignment)
+                {
+                    throw std::logic_error("data is not aligned");
+                }
+#endif
+                return static_cast<const T*>(SEAL_ASSUME_ALIGNED(data_, Alignment));
+            }
+
             inline const T *operator ->() const noexcept
             {
                 return data_;
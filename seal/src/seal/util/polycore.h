@@ -0,0 +1,286 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT license.
+
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "seal/util/defines.h"
+#include "seal/util/common.h"
+#include "seal/util/pointer.h"
+#include "seal/util/uintcore.h"
+
+namespace seal
+{
+    namespace util
+    {
+        // Order in which the coefficients of an array of RNS polynomials are
+        // laid out in memory; the polynomial index is always outermost
+        enum class poly_layout : int
+        {
+            // The RNS component index is the major one: the coefficients of one
+            // component are contiguous, so loops over coefficients have unit stride
+            component_major = 0,
+
+            // The coefficient index is the major one: the components of one
+            // coefficient are contiguous, so loops over components have unit stride
+            coeff_major = 1
+        };
+
+        /*
+        Non-owning view of poly_count RNS polynomials, each with component_count
+        components of coeff_count coefficients, stored contiguously in the given
+        layout. Element (poly, component, coeff) lives at
+        poly * poly_stride() + component * component_stride() + coeff * coeff_stride().
+        */
+        template<typename T>
+        class PolyView
+        {
+        public:
+            PolyView() = default;
+
+            PolyView(T *data, std::size_t poly_count, std::size_t component_count,
+                std::size_t coeff_count,
+                poly_layout layout = poly_layout::component_major) noexcept :
+                data_(data), poly_count_(poly_count),
+                component_count_(component_count), coeff_count_(coeff_count),
+                layout_(layout)
+            {
+            }
+
+            // A view of mutable elements converts to a view of const elements
+            template<typename S, typename = std::enable_if_t<
+                std::is_same<const S, T>::value && !std::is_same<S, T>::value>>
+            PolyView(const PolyView<S> &view) noexcept :
+                PolyView(view.data(), view.poly_count(), view.component_count(),
+                    view.coeff_count(), view.layout())
+            {
+            }
+
+            inline T *data() const noexcept
+            {
+                return data_;
+            }
+
+            inline std::size_t poly_count() const noexcept
+            {
+                return poly_count_;
+            }
+
+            inline std::size_t component_count() const noexcept
+            {
+                return component_count_;
+            }
+
+            inline std::size_t coeff_count() const noexcept
+            {
+                return coeff_count_;
+            }
+
+            inline poly_layout layout() const noexcept
+            {
+                return layout_;
+            }
+
+            // Total number of elements
+            inline std::size_t size() const noexcept
+            {
+                return poly_count_ * poly_stride();
+            }
+
+            inline std::size_t poly_stride() const noexcept
+            {
+                return component_count_ * coeff_count_;
+            }
+
+            inline std::size_t component_stride() const noexcept
+            {
+                return layout_ == poly_layout::component_major ? coeff_count_ : 1;
+            }
+
+            inline std::size_t coeff_stride() const noexcept
+            {
+                return layout_ == poly_layout::component_major ? 1 : component_count_;
+            }
+
+            inline T &operator ()(std::size_t poly_index, std::size_t component_index,
+                std::size_t coeff_index) const
+            {
+#ifdef SEAL_DEBUG
+                if (poly_index >= poly_count_ || component_index >= component_count_ ||
+                    coeff_index >= coeff_count_)
+                {
+                    throw std::out_of_range("index");
+                }
+#endif
+                return data_[poly_index * poly_stride() +
+                    component_index * component_stride() +
+                    coeff_index * coeff_stride()];
+            }
+
+            // Returns the first coefficient of a component; the following ones
+            // are coeff_stride() elements apart
+            inline T *component(std::size_t poly_index,
+                std::size_t component_index) const
+            {
+                return &(*this)(poly_index, component_index, 0);
+            }
+
+            // Returns the first component of a coefficient; the following ones
+            // are component_stride() elements apart
+            inline T *coeff(std::size_t poly_index, std::size_t coeff_index) const
+            {
+                return &(*this)(poly_index, 0, coeff_index);
+            }
+
+            // Returns a view of a single polynomial
+            inline PolyView<T> poly(std::size_t poly_index) const
+            {
+#ifdef SEAL_DEBUG
+                if (poly_index >= poly_count_)
+                {
+                    throw std::out_of_range("poly_index");
+                }
+#endif
+                return PolyView<T>(data_ + poly_index * poly_stride(), 1,
+                    component_count_, coeff_count_, layout_);
+            }
+
+        private:
+            T *data_ = nullptr;
+
+            std::size_t poly_count_ = 0;
+
+            std::size_t component_count_ = 0;
+
+            std::size_t coeff_count_ = 0;
+
+            poly_layout layout_ = poly_layout::component_major;
+        };
+
+        // Owning, pool-backed array of RNS polynomials in a single allocation
+        template<typename T>
+        class PolyArray
+        {
+        public:
+            PolyArray() = default;
+
+            PolyArray(Pointer<T> &&data, std::size_t poly_count,
+                std::size_t component_count, std::size_t coeff_count,
+                poly_layout layout) noexcept :
+                data_(std::move(data)),
+                view_(data_.get(), poly_count, component_count, coeff_count, layout)
+            {
+            }
+
+            PolyArray(PolyArray<T> &&source) noexcept :
+                data_(std::move(source.data_)), view_(source.view_)
+            {
+                source.view_ = PolyView<T>();
+            }
+
+            inline PolyArray<T> &operator =(PolyArray<T> &&assign) noexcept
+            {
+                data_.acquire(assign.data_);
+                view_ = assign.view_;
+                assign.view_ = PolyView<T>();
+                return *this;
+            }
+
+            inline PolyView<T> view() noexcept
+            {
+                return view_;
+            }
+
+            inline PolyView<const T> view() const noexcept
+            {
+                return view_;
+            }
+
+            inline T *data() noexcept
+            {
+                return view_.data();
+            }
+
+            inline const T *data() const noexcept
+            {
+                return view_.data();
+            }
+
+            inline std::size_t poly_count() const noexcept
+            {
+                return view_.poly_count();
+            }
+
+            inline std::size_t component_count() const noexcept
+            {
+                return view_.component_count();
+            }
+
+            inline std::size_t coeff_count() const noexcept
+            {
+                return view_.coeff_count();
+            }
+
+            inline poly_layout layout() const noexcept
+            {
+                return view_.layout();
+            }
+
+            inline T &operator ()(std::size_t poly_index, std::size_t component_index,
+                std::size_t coeff_index)
+            {
+                return view_(poly_index, component_index, coeff_index);
+            }
+
+            inline const T &operator ()(std::size_t poly_index,
+                std::size_t component_index, std::size_t coeff_index) const
+            {
+                return view_(poly_index, component_index, coeff_index);
+            }
+
+        private:
+            PolyArray(const PolyArray<T> &copy) = delete;
+
+            PolyArray<T> &operator =(const PolyArray<T> &assign) = delete;
+
+            Pointer<T> data_;
+
+            PolyView<T> view_;
+        };
+
+        // Counts are given in the order of the PolyView dimensions throughout: 
+        // polynomials, then RNS components, then coefficients
+        inline auto allocate_poly(std::size_t component_count, 
+            std::size_t coeff_count, MemoryPool &pool)
+        {
+            return allocate_uint(mul_safe(component_count, coeff_count), pool);
+        }
+
+        inline auto allocate_zero_poly(std::size_t component_count, 
+            std::size_t coeff_count, MemoryPool &pool)
+        {
+            return allocate_zero_uint(mul_safe(component_count, coeff_count), pool);
+        }
+
+        inline auto allocate_poly_array(std::size_t poly_count,
+            std::size_t component_count, std::size_t coeff_count, MemoryPool &pool,
+            poly_layout layout = poly_layout::component_major)
+        {
+            return PolyArray<std::uint64_t>(allocate_uint(
+                mul_safe(poly_count, component_count, coeff_count), pool),
+                poly_count, component_count, coeff_count, layout);
+        }
+
+        inline auto allocate_zero_poly_array(std::size_t poly_count,
+            std::size_t component_count, std::size_t coeff_count, MemoryPool &pool,
+            poly_layout layout = poly_layout::component_major)
+        {
+            return PolyArray<std::uint64_t>(allocate_zero_uint(
+                mul_safe(poly_count, component_count, coeff_count), pool),
+                poly_count, component_count, coeff_count, layout);
+        }
+    }
+}